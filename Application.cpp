@@ -5,13 +5,44 @@
 #include <sstream>
 #include <algorithm>
 
+#include <checkpoint.hpp>
 #include <exr.hpp>
+#include <memory.hpp>
+#include <system_utils.hpp>
 
 namespace haste {
 
+static RTCSceneFlags sceneFlags(const Options& options) {
+  RTCSceneFlags flags =
+      options.bvh_compact ? RTC_SCENE_COMPACT : RTCSceneFlags(0);
+
+  switch (options.bvh_quality) {
+    case bvh_quality_t::fast:
+      return flags | RTC_SCENE_DYNAMIC;
+    case bvh_quality_t::medium:
+      return flags | RTC_SCENE_STATIC;
+    default:
+      return flags | RTC_SCENE_STATIC | RTC_SCENE_HIGH_QUALITY;
+  }
+}
+
+// Embree reports every allocation (bytes > 0) and deallocation (bytes < 0)
+// of the device, most of it are the BVHs.
+static bool trackEmbreeMemory(const ssize_t bytes, const bool post) {
+  if (bytes > 0) {
+    memory_allocated(memory_tag_t::bvh, size_t(bytes));
+  } else {
+    memory_released(memory_tag_t::bvh, size_t(-bytes));
+  }
+
+  return true;
+}
+
 Application::Application(Options& options) {
   _device = rtcNewDevice(NULL);
   runtime_assert(_device != nullptr);
+  rtcDeviceSetMemoryMonitorFunction(_device, trackEmbreeMemory);
+  process_startup_report().mark("embree device");
 
   _options = options;
   _ui = make_shared<UserInterface>(options, _options.input0, _scale);
@@ -31,6 +62,7 @@ Application::Application(Options& options) {
     load_exr(_options.reference, metadata, width, height, _reference);
     _options.width = width;
     _options.height = height;
+    process_startup_report().mark("reference");
   }
 
   options = _options;
@@ -42,18 +74,32 @@ void Application::render(size_t width, size_t height, glm::dvec4* data) {
   auto view = subimage_view_t(data, width, height);
 
   if (_options.action == Options::Continue) {
-    map<string, string> metadata;
-    size_t width = 0; height = 0;
-    vector<vec4> image;
-    load_exr(_options.output, metadata, width, height, image);
+    string checkpoint_file = checkpoint_path(_options.output);
+
+    if (isfile(checkpoint_file)) {
+      checkpoint_t checkpoint;
+      load_checkpoint(checkpoint_file, checkpoint);
+      runtime_assert(checkpoint.width == width && checkpoint.height == height);
 
-    std::transform(
-      image.begin(),
-      image.end(),
-      data,
-      [](vec4 x) { return dvec4(x); });
+      std::copy(checkpoint.data.begin(), checkpoint.data.end(), data);
+      _generator.set_state(checkpoint.generator_state);
+      _technique->set_statistics(checkpoint.statistics);
+    }
+    else {
+      map<string, string> metadata;
+      size_t width = 0; height = 0;
+      vector<vec4> image;
+      load_exr(_options.output, metadata, width, height, image);
+
+      std::transform(
+        image.begin(),
+        image.end(),
+        data,
+        [](vec4 x) { return dvec4(x); });
+
+      _technique->set_statistics(load_statistics(_options.output, metadata));
+    }
 
-    _technique->set_statistics(statistics_t(metadata));
     _options.action = Options::Render;
 
     _num_seconds_saved = _num_seconds();
@@ -63,10 +109,35 @@ void Application::render(size_t width, size_t height, glm::dvec4* data) {
     _generator.seed(_options.seed + _technique->statistics().num_samples);
   }
 
+  size_t spp_per_frame = _options.spp_per_frame;
+
+  // Do not overshoot --num-samples in the last frame.
+  if (_options.num_samples != 0 && _num_samples < _options.num_samples) {
+    spp_per_frame = std::min(spp_per_frame, _options.num_samples - _num_samples);
+  }
+
+  _technique->set_spp_per_frame(spp_per_frame);
   _technique->render(view, _generator, _options.camera_id, _reference, _options.trace);
-  ++_num_samples;
+  _num_samples += spp_per_frame;
+
+  auto& startup_report = process_startup_report();
+
+  if (!startup_report.finished()) {
+    startup_report.mark("first sample");
+    startup_report.finish();
+
+    if (_options.startup_report) {
+      std::cout << startup_report;
+    }
+  }
 
   if (_options.technique != Options::Viewer) {
+    // Interactive sessions without an output don't leave a sidecar behind,
+    // saving from the UI writes the whole series anyway.
+    if (_options.batch || _options.snapshot != 0 || !_options.output.empty()) {
+      _sidecar.append(statistics_path(_options.get_output()), _technique->statistics());
+    }
+
     _printStatistics(
 		  view,
 		  _technique->statistics().records.back().frame_duration,
@@ -190,11 +261,17 @@ bool Application::updateScene() {
 
     if (_modificationTime < modificationTime) {
       if (_options.technique != Options::Viewer) {
-        _scene = loadScene(_options);
-        _scene->buildAccelStructs(_device);
+        auto scene = loadScene(_options);
+        scene->buildAccelStructs(_device, sceneFlags(_options), _scene.get());
+        _scene = scene;
+
+        if (!_options.quiet) {
+          std::cout << "Scene loaded in " << _scene->loadTimes << std::endl;
+        }
       }
 
       _technique = makeTechnique(_scene, _options);
+      process_startup_report().mark("technique");
 
       if (!_options.quiet) {
         std::cout << "Using: " << to_string(_options.technique) << std::endl;
@@ -226,7 +303,7 @@ void Application::_saveIfRequired(const subimage_view_t& view, double elapsed) {
   size_t num_samples = _num_samples;
 
   if (num_samples != 0) {
-    if (_options.num_samples != 0 && _options.num_samples == num_samples) {
+    if (_options.num_samples != 0 && _options.num_samples <= num_samples) {
       _save(view, num_samples, false);
     } else if (_options.num_seconds != 0.0 && _options.num_seconds <= elapsed) {
       _save(view, num_samples, false);
@@ -242,7 +319,7 @@ void Application::_updateQuitCond(const subimage_view_t& view, double elapsed) {
     return;
   }
 
-  if ((_options.num_samples != 0 && _options.num_samples == _num_samples) ||
+  if ((_options.num_samples != 0 && _options.num_samples <= _num_samples) ||
       (_options.num_seconds != 0.0 && _options.num_seconds <= elapsed)) {
     quit();
   }
@@ -250,14 +327,35 @@ void Application::_updateQuitCond(const subimage_view_t& view, double elapsed) {
 
 void Application::_save(const subimage_view_t& view, size_t num_samples,
                         bool snapshot) {
-  save_exr(_options, _technique->statistics(), view.data());
+  if (snapshot) {
+    string output = _options.get_output();
+    bool quiet = _options.quiet;
 
-  if (!_options.quiet) {
-    if (snapshot) {
-      std::cout << "Snapshot saved to `" << _options.get_output() << "`." << std::endl;
-    } else {
+    _writer.save(_options, _technique->statistics(), view.data(), _generator.state(), [=] {
+      if (!quiet) {
+        std::cout << "Snapshot saved to `" << output << "`." << std::endl;
+      }
+    });
+  }
+  else {
+    _writer.wait();
+
+    if (_options.checkpoint) {
+      save_checkpoint(
+        checkpoint_path(_options.get_output()),
+        _options,
+        _technique->statistics(),
+        _generator.state(),
+        view.data());
+    }
+
+    save_exr(_options, _technique->statistics(), view.data());
+
+    if (!_options.quiet) {
       std::cout << "Result saved to `" << _options.get_output() << "`." << std::endl;
       std::cout << _technique->statistics() << std::endl;
+      std::cout << "Memory usage:" << std::endl;
+      print_memory_usage(std::cout);
     }
   }
 }
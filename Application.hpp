@@ -2,6 +2,7 @@
 #include <framework.hpp>
 #include <Options.hpp>
 #include <Scene.hpp>
+#include <snapshot_writer.hpp>
 #include <Technique.hpp>
 #include <UserInterface.hpp>
 
@@ -44,5 +45,7 @@ class Application : public Framework {
   double _num_seconds_saved;
   vector<vec3> _reference;
   size_t _num_samples = 0;
+  snapshot_writer_t _writer;
+  statistics_sidecar_t _sidecar;
 };
 }
@@ -51,10 +51,10 @@ Mesh AreaLight::create_mesh(uint32_t material_index, const string& name) const {
     mesh.vertices[2] = vec4(position + size.x * left + size.y * up, 1.0f);
     mesh.vertices[3] = vec4(position - size.x * left + size.y * up, 1.0f);
 
-    mesh.tangents[0] = tangent;
-    mesh.tangents[1] = tangent;
-    mesh.tangents[2] = tangent;
-    mesh.tangents[3] = tangent;
+    mesh.tangents[0] = pack_frame(tangent);
+    mesh.tangents[1] = pack_frame(tangent);
+    mesh.tangents[2] = pack_frame(tangent);
+    mesh.tangents[3] = pack_frame(tangent);
 
     return mesh;
 }
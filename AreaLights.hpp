@@ -8,12 +8,22 @@
 
 namespace haste {
 
+// The vertices are padded to vec4 (w = 1), so Embree uses the buffers of
+// the mesh directly instead of keeping a copy. Indices hold 3 vertices per
+// face, or 4 if the mesh is made of quads (triangles repeat the last one).
 struct Mesh {
   string name;
   uint32_t material_id;
+  bool quads = false;
   vector<int> indices;
-  vector<vec3> vertices;
-  vector<mat3> tangents;
+  vector<vec4> vertices;
+  vector<packed_frame_t> tangents;
+};
+
+// A placement of Scene::prototypes[prototype] in the world.
+struct Instance {
+  uint32_t prototype;
+  mat4 transform;
 };
 
 enum light_kind {
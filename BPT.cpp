@@ -3,23 +3,43 @@
 namespace haste {
 
 template <class Beta>
-BPTBase<Beta>::BPTBase(const shared<const Scene>& scene, float lights, float roulette, float beta, size_t num_threads)
+BPTBase<Beta>::BPTBase(const shared<const Scene>& scene, float lights, float roulette, float beta, size_t max_path, size_t light_cache, size_t num_threads)
     : Technique(scene, num_threads)
     , _roulette(roulette)
     , _roulette_inv(1.0f / roulette)
-    , _lights(lights) {
+    , _lights(lights)
+    , _max_path(max_path)
+    , _cache_connections(light_cache) {
+}
+
+template <class Beta>
+typename BPTBase<Beta>::light_path_t& BPTBase<Beta>::_light_path_buffer() {
+    static thread_local light_path_t buffer;
+    buffer.clear();
+    return buffer;
 }
 
 template <class Beta>
 vec3 BPTBase<Beta>::_traceEye(render_context_t& context, Ray ray) {
-    light_path_t light_path;
     vec3 radiance = vec3(0.0f);
 
     if (_russian_roulette(*context.generator)) {
         return radiance;
     }
 
-    _traceLight(*context.generator, light_path);
+    const LightVertex* light_path = nullptr;
+    size_t light_size = 0;
+
+    if (_cache_connections == 0) {
+        light_path_t& buffer = _light_path_buffer();
+        _traceLight(*context.generator, buffer);
+        light_path = buffer.data();
+        light_size = buffer.size();
+    }
+    else {
+        light_path = _cache.data() + _cache_offsets[context.pixel_index];
+        light_size = _cache_offsets[context.pixel_index + 1] - _cache_offsets[context.pixel_index];
+    }
 
     EyeVertex eye[2];
     size_t itr = 0, prv = 1;
@@ -31,21 +51,23 @@ vec3 BPTBase<Beta>::_traceEye(render_context_t& context, Ray ray) {
     eye[prv].finite = 1;
     eye[prv].c = 0;
     eye[prv].C = 0;
+    eye[prv].V = 0;
+    eye[prv].length = 0;
 
     while (true) {
         if (eye[prv].surface.is_camera()) {
-            radiance += _connect_eye(context, eye[prv], light_path);
+            radiance += _connect_eye(context, eye[prv], light_path, light_size);
         }
         else {
-            radiance += _connect(context, eye[prv], light_path);
+            radiance += _connect(context, eye[prv], light_path, light_size);
         }
 
         auto bsdf = _scene->sampleBSDF(*context.generator, eye[prv].surface, eye[prv].omega);
 
         while (true) {
-            surface = _scene->intersect(surface, bsdf.omega);
+            auto hit = _scene->castRay(surface, bsdf.omega);
 
-            if (!surface.is_present()) {
+            if (!hit.is_present()) {
                 if (eye[prv].surface.is_camera()) {
                     return sky_gradient(bsdf.omega) *= _roulette_inv;
                 }
@@ -53,15 +75,14 @@ vec3 BPTBase<Beta>::_traceEye(render_context_t& context, Ray ray) {
                 return radiance;
             }
 
-            eye[itr].surface = surface;
             eye[itr].omega = -bsdf.omega;
 
-            auto edge = Edge(eye[prv].surface, eye[itr].surface, eye[itr].omega);
-
+            // The throughput and the roulette need only the frame of the
+            // previous vertex, a vertex that ends the path isn't built.
             eye[itr].throughput
                 = eye[prv].throughput
                 * bsdf.throughput
-                * edge.bCosTheta;
+                * abs(dot(bsdf.omega, eye[prv].surface.normal()));
 
             if (l1Norm(eye[itr].throughput) < FLT_EPSILON) {
               return radiance;
@@ -69,6 +90,17 @@ vec3 BPTBase<Beta>::_traceEye(render_context_t& context, Ray ray) {
 
             eye[itr].throughput /= bsdf.density;
 
+            bool is_light = _scene->isLight(hit);
+
+            if (!is_light && _russian_roulette(*context.generator)) {
+                return radiance;
+            }
+
+            surface = _scene->querySurface(hit);
+            eye[itr].surface = surface;
+
+            auto edge = Edge(eye[prv].surface, eye[itr].surface, eye[itr].omega);
+
             eye[prv].finite = min(eye[prv].finite, bsdf.finite);
             eye[itr].finite = bsdf.finite;
             eye[itr].c = 1.0f / Beta::beta(edge.fGeometry * bsdf.density);
@@ -80,24 +112,115 @@ vec3 BPTBase<Beta>::_traceEye(render_context_t& context, Ray ray) {
                 * Beta::beta(edge.bGeometry)
                 * eye[itr].c;
 
-            if (surface.is_light()) {
+            eye[itr].V
+                = (eye[prv].V
+                    * Beta::beta(bsdf.densityRev)
+                    + (eye[prv].length == 1 ? eye[prv].c * eye[prv].finite : 0.0f))
+                * Beta::beta(edge.bGeometry)
+                * eye[itr].c;
+
+            eye[itr].length = eye[prv].length + 1;
+
+            if (is_light) {
                 radiance += _connect_light(eye[itr]);
             }
             else {
+                eye[itr].throughput *= _roulette_inv;
                 break;
             }
         }
 
         std::swap(itr, prv);
+    }
+
+    return radiance;
+}
+
+template <class Beta>
+void BPTBase<Beta>::_preprocess(random_generator_t& generator, double num_samples) {
+    if (_cache_connections != 0) {
+        time_scope_t _(_statistics.scatter_time);
+        _trace_cache(generator);
+    }
+}
+
+template <class Beta>
+void BPTBase<Beta>::_trace_cache(random_generator_t& generator) {
+    const size_t num_paths = _eye_image.size();
+    const size_t num_tasks = _threadpool.num_threads();
 
-        if (_russian_roulette(*context.generator)) {
-            return radiance;
+    _cache_arenas.resize(num_tasks);
+
+    // The arena 0 is traced with the caller's generator, the others with
+    // generators cloned here as clone() advances the caller's one.
+    vector<random_generator_t> generators;
+    generators.reserve(num_tasks - 1);
+
+    for (size_t i = 1; i < num_tasks; ++i) {
+        generators.push_back(generator.clone());
+    }
+
+    exec1d(_threadpool, num_tasks, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto& arena = _cache_arenas[i];
+            auto& local_generator = i == 0 ? generator : generators[i - 1];
+
+            arena.paths.clear();
+            arena.offsets.resize(num_paths * (i + 1) / num_tasks - num_paths * i / num_tasks);
+
+            for (size_t j = 0; j < arena.offsets.size(); ++j) {
+                _traceLight(local_generator, arena.paths);
+                arena.offsets[j] = uint32_t(arena.paths.size());
+            }
         }
+    });
+
+    vector<size_t> path_bases(num_tasks + 1, 0);
+    vector<size_t> offset_bases(num_tasks + 1, 0);
 
-        eye[prv].throughput *= _roulette_inv;
+    for (size_t i = 0; i < num_tasks; ++i) {
+        path_bases[i + 1] = path_bases[i] + _cache_arenas[i].paths.size();
+        offset_bases[i + 1] = offset_bases[i] + _cache_arenas[i].offsets.size();
     }
 
-    return radiance;
+    _cache.resize(path_bases[num_tasks]);
+    _cache_offsets.resize(offset_bases[num_tasks] + 1);
+    _cache_offsets[0] = 0;
+
+    exec1d(_threadpool, num_tasks, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto& arena = _cache_arenas[i];
+            uint32_t base = uint32_t(path_bases[i]);
+
+            std::uninitialized_copy(arena.paths.begin(), arena.paths.end(),
+                                    _cache.data() + path_bases[i]);
+
+            for (size_t j = 0; j < arena.offsets.size(); ++j) {
+                _cache_offsets[offset_bases[i] + j + 1] = arena.offsets[j] + base;
+            }
+        }
+    });
+
+    // The first vertices of the subpaths are left to light sampling.
+    size_t num_vertices = 0;
+    _cache_vertices.resize(_cache.size());
+
+    for (size_t i = 0; i < _cache.size(); ++i) {
+        if (_cache[i].length != 0) {
+            _cache_vertices[num_vertices++] = uint32_t(i);
+        }
+    }
+
+    _cache_vertices.resize(num_vertices);
+
+    // An eye vertex takes _cache_connections of the num_vertices / num_paths
+    // vertices its own subpath would have on average.
+    float connections = num_vertices == 0
+        ? 1.0f
+        : float(_cache_connections) * float(num_paths) / float(num_vertices);
+
+    _cache_scale = 1.0f / connections;
+    _cache_mis = Beta::beta(connections);
 }
 
 template <class Beta>
@@ -108,7 +231,9 @@ typename BPTBase<Beta>::LightVertex BPTBase<Beta>::_sample_to_vertex(const Light
     vertex.throughput = sample.radiance() / sample.combined_density() * _roulette_inv;
     vertex.a = sample.kind == light_kind::directional ? 0.0f : 1.0f / Beta::beta(sample.combined_density());
     vertex.A = 0.0f;
+    vertex.U = 0.0f;
     vertex.finite = 1;
+    vertex.length = 0;
 
     return vertex;
 }
@@ -120,7 +245,8 @@ typename BPTBase<Beta>::LightVertex BPTBase<Beta>::_sample_light(random_generato
 
 template <class Beta>
 void BPTBase<Beta>::_traceLight(RandomEngine& generator, light_path_t& path) {
-    size_t itr = path.size() + 1, prv = path.size();
+    const size_t begin = path.size();
+    size_t itr = begin + 1, prv = begin;
 
     if (_russian_roulette(generator)) {
         return;
@@ -130,34 +256,32 @@ void BPTBase<Beta>::_traceLight(RandomEngine& generator, light_path_t& path) {
     path.emplace_back();
     path[prv] = _sample_to_vertex(sample);
 
-    while (!_russian_roulette(generator)) {
+    while (path.size() - begin < _max_path && !_russian_roulette(generator)) {
         auto bsdf = _scene->sampleBSDF(generator, path[prv].surface, path[prv].omega);
 
-        auto surface = _scene->intersectMesh(path[prv].surface, bsdf.omega);
+        auto hit = _scene->castMeshRay(path[prv].surface, bsdf.omega);
 
-        if (!surface.is_present()) {
+        if (!hit.is_present()) {
             break;
         }
 
-        path.emplace_back();
-
-        path[itr].surface = surface;
-        path[itr].omega = -bsdf.omega;
-
-        auto edge = Edge(path[prv].surface, path[itr].surface, path[itr].omega);
-
-        path[itr].throughput
+        vec3 throughput
             = path[prv].throughput
             * bsdf.throughput
-            * edge.bCosTheta
+            * abs(dot(bsdf.omega, path[prv].surface.normal()))
             * _roulette_inv;
 
-        if (l1Norm(path[itr].throughput) < FLT_EPSILON) {
-            path.pop_back();
+        if (l1Norm(throughput) < FLT_EPSILON) {
             break;
         }
 
-        path[itr].throughput /= bsdf.density;
+        path.emplace_back();
+
+        path[itr].surface = _scene->querySurface(hit);
+        path[itr].omega = -bsdf.omega;
+        path[itr].throughput = throughput / bsdf.density;
+
+        auto edge = Edge(path[prv].surface, path[itr].surface, path[itr].omega);
 
         path[prv].finite = min(path[prv].finite, bsdf.finite);
         path[itr].finite = bsdf.finite;
@@ -171,6 +295,15 @@ void BPTBase<Beta>::_traceLight(RandomEngine& generator, light_path_t& path) {
             * Beta::beta(edge.bGeometry)
             * path[itr].a;
 
+        path[itr].U
+            = (path[prv].U
+                * Beta::beta(bsdf.densityRev)
+                + (path[prv].length <= 1 ? path[prv].a * path[prv].finite : 0.0f))
+            * Beta::beta(edge.bGeometry)
+            * path[itr].a;
+
+        path[itr].length = path[prv].length + 1;
+
         if (bsdf.finite == 0) {
             path[prv] = path[itr];
             path.pop_back();
@@ -202,14 +335,17 @@ template <class Beta> vec3 BPTBase<Beta>::_connect(
     auto edge = Edge(light.surface, eye.surface, omega);
 
     float Ap
-        = (light.A * Beta::beta(lightBSDF.densityRev) + light.a * light.finite)
+        = (_cached(light.A, light.U) * Beta::beta(lightBSDF.densityRev)
+            + light.a * light.finite * (light.length <= 1 ? 1.0f : _cache_mis))
         * Beta::beta(edge.bGeometry * eyeBSDF.densityRev);
 
     float Cp
-        = (eye.C * Beta::beta(eyeBSDF.density) + eye.c * eye.finite)
+        = (_cached(eye.C, eye.V) * Beta::beta(eyeBSDF.density)
+            + eye.c * eye.finite * (eye.length <= 1 ? 1.0f : _cache_mis))
         * Beta::beta(edge.fGeometry * lightBSDF.density);
 
-    float weightInv = Ap + Cp + 1.0f;
+    float current = light.length != 0 && eye.length != 0 ? _cache_mis : 1.0f;
+    float weightInv = (Ap + Cp) / current + 1.0f;
 
     vec3 result = _scene->occluded(eye.surface, light.surface)
         * light.throughput
@@ -232,7 +368,8 @@ template <class Beta> vec3 BPTBase<Beta>::_connect_light(const EyeVertex& eye) {
     auto lsdf = _scene->queryLSDF(eye.surface, eye.omega);
 
     float Cp
-        = (eye.C * Beta::beta(bsdf.density) + eye.c * eye.finite)
+        = (_cached(eye.C, eye.V) * Beta::beta(bsdf.density)
+            + eye.c * eye.finite)
         * Beta::beta(lsdf.density);
 
     float weightInv = Cp + 1.0f;
@@ -244,13 +381,14 @@ template <class Beta> vec3 BPTBase<Beta>::_connect_light(const EyeVertex& eye) {
 
 template <class Beta>
 vec3 BPTBase<Beta>::_connect_directional(const EyeVertex& eye, const LightSample& sample) {
-    auto isect = _scene->intersect(eye.surface, -sample.normal());
+    auto isect = _scene->castRay(eye.surface, -sample.normal());
 
-    if (isect.material_id == sample.surface.material_id) {
+    if (_scene->queryMaterial(isect) == sample.surface.material_id) {
         auto eyeBSDF = _scene->queryBSDF(eye.surface, -sample.normal(), eye.omega);
 
         float Cp
-            = (eye.C * Beta::beta(eyeBSDF.density) + eye.c * eye.finite)
+            = (_cached(eye.C, eye.V) * Beta::beta(eyeBSDF.density)
+                + eye.c * eye.finite * (eye.length <= 1 ? 1.0f : _cache_mis))
             * Beta::beta(abs(dot(sample.normal(), eye.surface.normal()))
                 / distance2(isect.position(), eye.surface.position()));
 
@@ -269,7 +407,7 @@ vec3 BPTBase<Beta>::_connect_directional(const EyeVertex& eye, const LightSample
 }
 
 template <class Beta>
-vec3 BPTBase<Beta>::_connect(render_context_t& context, const EyeVertex& eye, const light_path_t& path) {
+vec3 BPTBase<Beta>::_connect(render_context_t& context, const EyeVertex& eye, const LightVertex* path, size_t size) {
     vec3 radiance = vec3(0.0f);
 
     if (!_russian_roulette(*context.generator)) {
@@ -283,21 +421,44 @@ vec3 BPTBase<Beta>::_connect(render_context_t& context, const EyeVertex& eye, co
         }
     }
 
-    for (size_t i = 1; i < path.size(); ++i) {
-        radiance += _connect(path[i], eye);
+    if (_cache_connections != 0) {
+        radiance += _connect_cache(context, eye);
+    }
+    else {
+        for (size_t i = 1; i < size; ++i) {
+            radiance += _connect(path[i], eye);
+        }
     }
 
     return radiance;
 }
 
+template <class Beta>
+vec3 BPTBase<Beta>::_connect_cache(render_context_t& context, const EyeVertex& eye) {
+    vec3 radiance = vec3(0.0f);
+    const size_t num_vertices = _cache_vertices.size();
+
+    if (num_vertices == 0) {
+        return radiance;
+    }
+
+    for (size_t i = 0; i < _cache_connections; ++i) {
+        size_t index = min(size_t(context.generator->sample() * num_vertices), num_vertices - 1);
+        radiance += _connect(_cache[_cache_vertices[index]], eye);
+    }
+
+    return radiance * _cache_scale;
+}
+
 template <class Beta>
 vec3 BPTBase<Beta>::_connect_eye(
     render_context_t& context,
     const EyeVertex& eye,
-    const light_path_t& path) {
+    const LightVertex* path,
+    size_t size) {
     vec3 radiance = vec3(0.0f);
 
-    for (size_t index = 0; index < path.size(); ++index) {
+    for (size_t index = 0; index < size; ++index) {
         vec3 omega = normalize(path[index].surface.position() - eye.surface.position());
 
         radiance += _accumulate(
@@ -318,13 +479,18 @@ vec3 BPTBase<Beta>::_connect_eye(
     return radiance;
 }
 
+template <class Beta>
+float BPTBase<Beta>::_cached(float total, float other) const {
+    return _cache_connections == 0 ? total : other + _cache_mis * (total - other);
+}
+
 template <class Beta>
 bool BPTBase<Beta>::_russian_roulette(random_generator_t& generator) const {
     return _roulette < generator.sample();
 }
 
-BPTb::BPTb(const shared<const Scene>& scene, float lights, float roulette, float beta, size_t num_threads)
-    : BPTBase<VariableBeta>(scene, lights, roulette, beta, num_threads)
+BPTb::BPTb(const shared<const Scene>& scene, float lights, float roulette, float beta, size_t max_path, size_t light_cache, size_t num_threads)
+    : BPTBase<VariableBeta>(scene, lights, roulette, beta, max_path, light_cache, num_threads)
 {
     VariableBeta::init(beta);
 }
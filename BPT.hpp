@@ -1,5 +1,5 @@
 #pragma once
-#include <fixed_vector.hpp>
+#include <memory.hpp>
 #include <Technique.hpp>
 #include <Beta.hpp>
 
@@ -7,41 +7,72 @@ namespace haste {
 
 template <class Beta> class BPTBase : public Technique, protected Beta {
 public:
-    BPTBase(const shared<const Scene>& scene, float lights, float roulette, float beta, size_t num_threads);
+    BPTBase(const shared<const Scene>& scene, float lights, float roulette, float beta, size_t max_path, size_t light_cache, size_t num_threads);
 
 private:
     struct LightVertex {
         SurfacePoint surface;
         vec3 omega;
         vec3 throughput;
-        float a, A;
-        uint16_t finite;
+        float a, A, U;
+        uint16_t finite, length;
     };
 
     struct EyeVertex {
         SurfacePoint surface;
         vec3 omega;
         vec3 throughput;
-        float c, C;
-        uint16_t finite;
+        float c, C, V;
+        uint16_t finite, length;
+    };
+
+    // Light subpaths are traced into a buffer owned by the worker thread,
+    // it grows to the longest subpath seen and is reused by every sample.
+    using light_path_t = tracked_buffer_t<LightVertex, memory_tag_t::light_paths>;
+    using light_offsets_t = tracked_buffer_t<uint32_t, memory_tag_t::light_offsets>;
+
+    // Light subpaths of the cache traced by one task, the offsets are the
+    // ends of the task's subpaths.
+    struct cache_arena_t {
+        light_path_t paths;
+        light_offsets_t offsets;
     };
 
-    static const size_t _maxSubpath = 1024;
-    using light_path_t = fixed_vector<LightVertex, _maxSubpath>;
     const float _roulette;
     const float _roulette_inv;
     const float _lights;
+    const size_t _max_path;
+
+    // With the light vertex cache every pixel connects its camera vertex to
+    // its own subpath of the cache and every other eye vertex to
+    // _cache_connections vertices chosen from the whole cache. U and V are
+    // the parts of A and C that belong to the strategies that aren't
+    // connections (the eye hits or samples a light, the light connects to
+    // the camera), the remaining ones are taken _cache_mis times.
+    const size_t _cache_connections;
+    float _cache_scale = 1.0f;
+    float _cache_mis = 1.0f;
+    light_path_t _cache;
+    light_offsets_t _cache_offsets;
+    light_offsets_t _cache_vertices;
+    vector<cache_arena_t> _cache_arenas;
+
+    static light_path_t& _light_path_buffer();
 
     vec3 _traceEye(render_context_t& context, Ray ray) override;
+    void _preprocess(random_generator_t& generator, double num_samples) override;
+    void _trace_cache(random_generator_t& generator);
     LightVertex _sample_to_vertex(const LightSample& sample);
     LightVertex _sample_light(random_generator_t& generator);
     void _traceLight(random_generator_t& generator, light_path_t& path);
     vec3 _connect(const LightVertex& light, const EyeVertex& eye);
     vec3 _connect_light(const EyeVertex& eye);
     vec3 _connect_directional(const EyeVertex& eye, const LightSample& sample);
-    vec3 _connect(render_context_t& context, const EyeVertex& eye, const light_path_t& path);
-    vec3 _connect_eye(render_context_t& context, const EyeVertex& eye, const light_path_t& path);
+    vec3 _connect(render_context_t& context, const EyeVertex& eye, const LightVertex* path, size_t size);
+    vec3 _connect_cache(render_context_t& context, const EyeVertex& eye);
+    vec3 _connect_eye(render_context_t& context, const EyeVertex& eye, const LightVertex* path, size_t size);
 
+    float _cached(float total, float other) const;
     bool _russian_roulette(random_generator_t& generator) const;
 };
 
@@ -51,7 +82,7 @@ typedef BPTBase<FixedBeta<2>> BPT2;
 
 class BPTb : public BPTBase<VariableBeta> {
 public:
-    BPTb(const shared<const Scene>& scene, float lights, float roulette, float beta, size_t num_threads);
+    BPTb(const shared<const Scene>& scene, float lights, float roulette, float beta, size_t max_path, size_t light_cache, size_t num_threads);
 };
 
 }
@@ -7,6 +7,7 @@
 #include <vector>
 #include <algorithm>
 #include <cstdint>
+#include <memory.hpp>
 #include "flat_hash_map.hpp"
 
 namespace std
@@ -173,8 +174,8 @@ template <class T> class HashGrid3D {
 public:
     HashGrid3D() { }
 
-    HashGrid3D(const vector<T>* that, float radius)
-        : _data(that) {
+    template <class Container> HashGrid3D(const Container* that, float radius)
+        : _data(that->data()) {
         build(*that, radius);
     }
 
@@ -207,7 +208,7 @@ public:
         size_t itr = 0;
 
         auto callback = [&](uint32_t index) {
-            result[itr] = _data->operator[](index);
+            result[itr] = _data[index];
             ++itr;
         };
 
@@ -216,14 +217,79 @@ public:
         return itr;
     }
 
+    // Runs num_queries queries and reports callback(query, index) for every
+    // point, in the same order as rQuery does query by query. The queries
+    // are processed in groups of K: the hash slots of all cells of a group
+    // are prefetched first, then the ranges are looked up and the first
+    // points of every range prefetched, and the points are tested only
+    // after that, so the cache misses of a group overlap.
+    template <size_t K = 8, class Callback> void rQueryBatch(
+        Callback callback,
+        const vec3* queries,
+        size_t num_queries,
+        const float radius) const
+    {
+        static const size_t num_cells = 9;
+        static const uint32_t points_per_line = 64 / sizeof(Point);
+        static const uint32_t prefetch_lines = 4;
+
+        const float radiusSq = radius * radius;
+
+        vec3 keys[K][num_cells];
+        const Range* ranges[K][num_cells];
+
+        for (size_t group = 0; group < num_queries; group += K) {
+            const size_t size = std::min(K, num_queries - group);
+
+            for (size_t i = 0; i < size; ++i) {
+                vec3 center = floor(queries[group + i] * _radius_inv);
+
+                for (size_t j = 0; j < num_cells; ++j) {
+                    keys[i][j] = vec3(center.x, center.y + float(j % 3) - 1.f, center.z + float(j / 3) - 1.f);
+                    _ranges.prefetch(keys[i][j]);
+                }
+            }
+
+            for (size_t i = 0; i < size; ++i) {
+                for (size_t j = 0; j < num_cells; ++j) {
+                    auto cell = _ranges.find(keys[i][j]);
+                    const Range* range = cell != _ranges.end() ? &cell->second : nullptr;
+                    ranges[i][j] = range;
+
+                    if (range) {
+                        uint32_t end = std::min(range->end, range->begin + prefetch_lines * points_per_line);
+
+                        for (uint32_t k = range->begin; k < end; k += points_per_line) {
+                            _mm_prefetch(reinterpret_cast<const char*>(_points.data() + k), _MM_HINT_T0);
+                        }
+                    }
+                }
+            }
+
+            for (size_t i = 0; i < size; ++i) {
+                const vec3& query = queries[group + i];
+
+                for (size_t j = 0; j < num_cells; ++j) {
+                    if (const Range* range = ranges[i][j]) {
+                        for (uint32_t k = range->begin; k < range->end; ++k) {
+                            if (distance2(query, _points[k].cell) < radiusSq) {
+                                callback(group + i, _points[k].index);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
 private:
     struct Point {
         vec3 cell;
         uint32_t index;
     };
 
-    const vector<T>* _data = nullptr;
-    vector<Point> _points;
+    const T* _data = nullptr;
+    tracked_vector<Point, memory_tag_t::photon_grid> _points;
     float _radius;
     float _radius_inv;
 
@@ -232,9 +298,14 @@ private:
         uint32_t end;
     };
 
-    ska::flat_hash_map<vec3, Range> _ranges;
+    ska::flat_hash_map<
+        vec3,
+        Range,
+        std::hash<vec3>,
+        std::equal_to<vec3>,
+        tracked_allocator_t<std::pair<vec3, Range>, memory_tag_t::photon_grid>> _ranges;
 
-    void build(const vector<T>& data, float radius) {
+    template <class Container> void build(const Container& data, float radius) {
         struct Comparator {
             bool operator()(const vec3& a, const vec3& b) const {
                 return a.z != b.z ? a.z < b.z : (a.y != b.y ? a.y < b.y : a.x < b.x);
@@ -316,7 +387,7 @@ private:
 
 
         for (uint32_t i = 0; i < _points.size(); ++i) {
-            _points[i].cell = _data->operator[](_points[i].index).position();
+            _points[i].cell = _data[_points[i].index].position();
         }
 
         _radius = radius;
@@ -1,5 +1,6 @@
 #include <cstring>
 #include <stdexcept>
+#include <unittest>
 #include <ImageView.hpp>
 
 namespace haste {
@@ -57,6 +58,70 @@ void subimage_view_t::copyFrom(const std::vector<dvec4>& data, size_t width, siz
     }
 }
 
+void planar_image_t::resize(size_t size, bool compensated) {
+    this->compensated = compensated;
+    r.assign(size, 0.0f);
+    g.assign(size, 0.0f);
+    b.assign(size, 0.0f);
+
+    if (compensated) {
+        cr.assign(size, 0.0f);
+        cg.assign(size, 0.0f);
+        cb.assign(size, 0.0f);
+    }
+    else {
+        cr = cg = cb = vector<float>();
+    }
+}
+
+vec3 planar_image_t::at(size_t index) const {
+    vec3 result = vec3(r[index], g[index], b[index]);
+    return compensated ? result - vec3(cr[index], cg[index], cb[index]) : result;
+}
+
+void planar_image_t::fold(size_t begin, size_t end) {
+    if (compensated) {
+        float* __restrict pr = r.data();
+        float* __restrict pg = g.data();
+        float* __restrict pb = b.data();
+        const float* __restrict qr = cr.data();
+        const float* __restrict qg = cg.data();
+        const float* __restrict qb = cb.data();
+
+        for (size_t i = begin; i < end; ++i) {
+            pr[i] -= qr[i];
+            pg[i] -= qg[i];
+            pb[i] -= qb[i];
+        }
+    }
+}
+
+void planar_image_t::clear(size_t begin, size_t end) {
+    size_t count = (end - begin) * sizeof(float);
+    std::memset(r.data() + begin, 0, count);
+    std::memset(g.data() + begin, 0, count);
+    std::memset(b.data() + begin, 0, count);
+
+    if (compensated) {
+        std::memset(cr.data() + begin, 0, count);
+        std::memset(cg.data() + begin, 0, count);
+        std::memset(cb.data() + begin, 0, count);
+    }
+}
+
+unittest() {
+    planar_image_t image;
+    image.resize(1, true);
+
+    image.add(0, vec3(1.0f));
+
+    for (size_t i = 0; i < 1000000; ++i) {
+        image.add(0, vec3(1e-8f));
+    }
+
+    assert_almost_eq(image.at(0), vec3(1.01f));
+}
+
 void rms_abs_errors(
     float& rms,
     float& abs,
@@ -2,6 +2,7 @@
 #include <glm>
 #include <vector>
 #include <runtime_assert>
+#include <memory.hpp>
 
 namespace haste {
 
@@ -66,6 +67,46 @@ struct subimage_view_t {
   }
 };
 
+// Single precision planar (SoA) image used to gather the contributions of
+// one frame before they are committed to the dvec4 accumulator. When
+// compensated, every channel keeps a Kahan compensation plane, so the sum
+// of many splats does not drift. fold() applies the compensation to the
+// sums, clear() resets both.
+struct planar_image_t {
+  using channel_t = tracked_vector<float, memory_tag_t::framebuffer>;
+
+  channel_t r, g, b;
+  channel_t cr, cg, cb;
+  bool compensated = false;
+
+  void resize(size_t size, bool compensated);
+  size_t size() const { return r.size(); }
+
+  void add(size_t index, vec3 value) {
+    if (compensated) {
+      kahan_add(r[index], cr[index], value.x);
+      kahan_add(g[index], cg[index], value.y);
+      kahan_add(b[index], cb[index], value.z);
+    }
+    else {
+      r[index] += value.x;
+      g[index] += value.y;
+      b[index] += value.z;
+    }
+  }
+
+  vec3 at(size_t index) const;
+  void fold(size_t begin, size_t end);
+  void clear(size_t begin, size_t end);
+
+  static void kahan_add(float& sum, float& carry, float value) {
+    float y = value - carry;
+    float t = sum + y;
+    carry = (t - sum) - y;
+    sum = t;
+  }
+};
+
 template <class T> struct image_view_t {
   image_view_t(
     T* data,
@@ -8,6 +8,23 @@
 
 namespace haste {
 
+// A ray hit without the shading frame. It is enough to test what was hit
+// and where, Scene::querySurface computes the SurfacePoint when needed.
+struct hit_t {
+  vec3 origin;
+  vec3 direction;
+  vec3 gnormal;
+  float t;
+  float u;
+  float v;
+  unsigned geom_id;
+  unsigned prim_id;
+  unsigned inst_id;
+
+  bool is_present() const { return geom_id != RTC_INVALID_GEOMETRY_ID; }
+  vec3 position() const { return origin + direction * t; }
+};
+
 class Intersector {
  public:
   virtual ~Intersector();
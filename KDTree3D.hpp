@@ -2,6 +2,7 @@
 #include <glm>
 #include <vector>
 #include <algorithm>
+#include <memory.hpp>
 
 namespace haste {
 
@@ -423,7 +424,7 @@ public:
     KDTree3D() { }
 
     KDTree3D(const vector<T>* that, float) {
-        _data = *that;
+        _data.assign(that->begin(), that->end());
         _points.resize(_data.size());
         _axes.resize(_data.size());
 
@@ -627,8 +628,8 @@ public:
     }
 
 private:
-    vector<T> _data;
-    vector<vec3> _points;
+    tracked_vector<T, memory_tag_t::kd_tree> _data;
+    tracked_vector<vec3, memory_tag_t::kd_tree> _points;
     BitfieldVector<2> _axes;
 
     void query_k(
@@ -695,10 +696,10 @@ private:
         }
     }
 
-    template <size_t D> static void sort(
+    template <size_t D, class Points> static void sort(
         vector<size_t>& v,
         const vector<size_t>& unique,
-        const vector<vec3>& data) {
+        const Points& data) {
         std::sort(v.begin(), v.end(), [&](size_t a, size_t b) -> bool {
             return data[a][D] == data[b][D] ? unique[a] < unique[b] : data[a][D] < data[b][D];
         });
@@ -10,6 +10,7 @@
 #include <UPG.hpp>
 #include <Viewer.hpp>
 
+#include <checkpoint.hpp>
 #include <exr.hpp>
 #include <system_utils.hpp>
 
@@ -46,11 +47,14 @@ R"(
       --BPT                           Use bidirectional path tracing (balance heuristics).
       --VCM                           Use vertex connection and merging.
       --UPG                           Use unbiased photon gathering.
-      --num-photons=<n>               Use <n> photons. [default: 1 000 000]
+      --num-photons=<n>               Use <n> photons, independent of the resolution. [default: width * height]
       --radius=<n>                    Use <n> as maximum gather radius. [default: 0.1]
+      --auto-tune                     Derive the radius from the first pass and adjust the number of photons every frame (VCM, UPG).
       --roulette=<n>                  Russian roulette coefficient. [default: 0.5]
       --beta=<n>                      MIS beta. [default: 1]
       --alpha=<n>                     VCM alpha. [default: 0.75]
+      --max-path=<n>                  Maximum path length (PT) or light subpath length (BPT).
+      --light-cache=<n>               Connect every eye vertex to <n> vertices of light subpaths shared by all pixels (BPT). [default: 0, off]
       --batch                         Run in batch mode (interactive otherwise).
       --quiet                         Do not output anything to console.
       --no-vc                         Disable vertex connection.
@@ -60,20 +64,33 @@ R"(
       --from-light                    Merge from light perspective.
       --no-lights                     Do not draw the lights.
       --no-reload                     Disable auto-reload (input file is reloaded on modification in interactive mode).
+      --no-scene-cache                Always import the scene with Assimp, do not read or write <input>.cache.
+      --bvh-quality=<q>               Quality of the BVH: fast, medium or high. [default: high]
+      --bvh-compact                   Build a compact BVH that uses less memory.
+      --startup-report                Print the time and peak memory of every startup phase and store them in the output metadata.
       --num-samples=<n>               Terminate after <n> samples.
+      --spp-per-frame=<n>             Trace <n> samples per pixel before committing a frame. [default: 1]
       --num-seconds=<n>               Terminate after <n> seconds.
       --num-minutes=<n>               Terminate after <n> minutes.
       --parallel                      Use multi-threading.
+      --threads=<n>                   Use <n> threads.
       --output=<path>                 Output file. <input>.<width>.<height>.<time>.<technique>.exr if not specified.
       --reference=<path>              Reference file for comparison.
       --seed=<n>                      Seed random number generator.
       --snapshot=<n>                  Save output every <n> seconds.
+      --checkpoint                    Save a full precision checkpoint next to the output, continue resumes from it.
+      --workers=<n>                   Render with <n> worker processes, merge their partial results into the output.
+      --exr-compression=<c>           Compression of the output: none, zip, piz or dwaa. [default: zip]
+      --exr-half                      Store normalized colors of the output as half floats, continue and merge need --checkpoint then.
+      --exr-threads=<n>               Use <n> threads to encode the output. [default: 0]
       --camera=<id>                   Use camera with given id. [default: 0]
       --resolution=<WxH>              Resolution of output image. [default: 512x512]
       --trace=<XxY[xW]>               Trace errors in window of radius W and at the center at XxY. [default: XxYx2]
       --sky-horizon=<RxGxB>           Color of sky horizon. [default: 0x0x0]
       --sky-zenith=<RxGxB>            Color of sky zenith. [default: 0x0x0]
       --blue-sky=<B>                  Alias to --sky-horizon=<0x0x0> --sky-zenith<0x0xB>. [default: 0]
+      --tile-order=<order>            Order of tile traversal: linear, morton or hilbert. [default: linear]
+      --pixel-order=<order>           Order of pixel traversal within a tile: linear, morton or hilbert. [default: linear]
 
     Options (gnuplot):
       --input=<path>                  The path to .exr file containing error data.
@@ -100,6 +117,9 @@ R"(
       Render scene.blend using UPG use all cores compute errors for multiple windows.
         master scene.blend --UPG --output=image.exr --reference=reference.exr --trace=32x32x8 --trace=42x142x16
 
+      Render scene.blend using BPT in 4 processes, merge the partial results every 10 minutes.
+        master scene.blend --BPT --output=image.exr --workers=4 --snapshot=600 --num-minutes=600
+
       Merge two results from two different images.
         master output.exr image-machineA.exr image-machineB.exr
 
@@ -548,8 +568,21 @@ Options parseArgs(int argc, char const* const* argv) {
             }
         }
 
+        if (dict.count("--auto-tune")) {
+            if (options.technique != Options::VCM &&
+                options.technique != Options::UPG) {
+                options.displayHelp = true;
+                options.displayMessage = "--auto-tune can be specified for VCM and UPG.";
+                return options;
+            }
+            else {
+                options.auto_tune = true;
+                dict.erase("--auto-tune");
+            }
+        }
+
         if (dict.count("--max-path")) {
-            if (options.technique != Options::PT) {
+            if (options.technique != Options::PT && options.technique != Options::BPT) {
                 options.displayHelp = true;
                 options.displayMessage = "--max-path in not available for specified technique.";
                 return options;
@@ -565,6 +598,23 @@ Options parseArgs(int argc, char const* const* argv) {
             }
         }
 
+        if (dict.count("--light-cache")) {
+            if (options.technique != Options::BPT) {
+                options.displayHelp = true;
+                options.displayMessage = "--light-cache is only valid with --BPT.";
+                return options;
+            }
+            else if (!isUnsigned(dict.find("--light-cache")->second)) {
+                options.displayHelp = true;
+                options.displayMessage = "Invalid value for --light-cache.";
+                return options;
+            }
+            else {
+                options.light_cache = atoi(dict.find("--light-cache")->second.c_str());
+                dict.erase("--light-cache");
+            }
+        }
+
         if (dict.count("--beta")) {
             if (options.technique != Options::BPT &&
                 options.technique != Options::PT &&
@@ -713,6 +763,33 @@ Options parseArgs(int argc, char const* const* argv) {
             dict.erase("--no-reload");
         }
 
+        if (dict.count("--no-scene-cache")) {
+            options.scene_cache = false;
+            dict.erase("--no-scene-cache");
+        }
+
+        if (dict.count("--bvh-quality")) {
+            try {
+                options.bvh_quality = bvh_quality(dict.find("--bvh-quality")->second);
+                dict.erase("--bvh-quality");
+            }
+            catch (const std::invalid_argument&) {
+                options.displayHelp = true;
+                options.displayMessage = "Invalid value for --bvh-quality.";
+                return options;
+            }
+        }
+
+        if (dict.count("--bvh-compact")) {
+            options.bvh_compact = true;
+            dict.erase("--bvh-compact");
+        }
+
+        if (dict.count("--startup-report")) {
+            options.startup_report = true;
+            dict.erase("--startup-report");
+        }
+
         if (dict.count("--num-samples")) {
             if (!isUnsigned(dict.find("--num-samples")->second)) {
                 options.displayHelp = true;
@@ -758,6 +835,19 @@ Options parseArgs(int argc, char const* const* argv) {
             dict.erase("--parallel");
         }
 
+        if (dict.count("--threads")) {
+            if (!isUnsigned(dict.find("--threads")->second) ||
+                atoi(dict.find("--threads")->second.c_str()) == 0) {
+                options.displayHelp = true;
+                options.displayMessage = "Invalid value for --threads.";
+                return options;
+            }
+            else {
+                options.num_threads = atoi(dict.find("--threads")->second.c_str());
+                dict.erase("--threads");
+            }
+        }
+
         if (dict.count("--snapshot")) {
             if (!isUnsigned(dict.find("--snapshot")->second)) {
                 options.displayHelp = true;
@@ -826,11 +916,6 @@ Options parseArgs(int argc, char const* const* argv) {
                 options.displayMessage = "--seed is only valid with --BPT or --UPG.";
                 return options;
             }
-            else if (options.num_threads != 1) {
-                options.displayHelp = true;
-                options.displayMessage = "--seed is invalid with --parallel.";
-                return options;
-            }
             else if (!isUnsigned(dict.find("--seed")->second)) {
                 options.displayHelp = true;
                 options.displayMessage = "Invalid value for --seed.";
@@ -911,6 +996,99 @@ Options parseArgs(int argc, char const* const* argv) {
             dict.erase("--sky-zenith");
         }
 
+        if (dict.count("--spp-per-frame")) {
+            if (!isUnsigned(dict.find("--spp-per-frame")->second)) {
+                options.displayHelp = true;
+                options.displayMessage = "Invalid value for --spp-per-frame.";
+                return options;
+            }
+            else {
+                options.spp_per_frame = atoi(dict.find("--spp-per-frame")->second.c_str());
+                dict.erase("--spp-per-frame");
+
+                if (options.spp_per_frame == 0) {
+                    options.displayHelp = true;
+                    options.displayMessage = "A value for --spp-per-frame must be positive.";
+                    return options;
+                }
+            }
+        }
+
+        if (dict.count("--exr-compression")) {
+            try {
+                options.exr_compression = exr_compression(dict.find("--exr-compression")->second);
+                dict.erase("--exr-compression");
+            }
+            catch (const std::invalid_argument&) {
+                options.displayHelp = true;
+                options.displayMessage = "Invalid value for --exr-compression.";
+                return options;
+            }
+        }
+
+        if (dict.count("--workers")) {
+            if (!isUnsigned(dict.find("--workers")->second)) {
+                options.displayHelp = true;
+                options.displayMessage = "Invalid value for --workers.";
+                return options;
+            }
+            else if (options.technique == Options::Viewer) {
+                options.displayHelp = true;
+                options.displayMessage = "--workers requires a rendering technique.";
+                return options;
+            }
+            else {
+                options.num_workers = atoi(dict.find("--workers")->second.c_str());
+                dict.erase("--workers");
+            }
+        }
+
+        if (dict.count("--checkpoint")) {
+            options.checkpoint = true;
+            dict.erase("--checkpoint");
+        }
+
+        if (dict.count("--exr-half")) {
+            options.exr_half = true;
+            dict.erase("--exr-half");
+        }
+
+        if (dict.count("--exr-threads")) {
+            if (!isUnsigned(dict.find("--exr-threads")->second)) {
+                options.displayHelp = true;
+                options.displayMessage = "Invalid value for --exr-threads.";
+                return options;
+            }
+            else {
+                options.exr_threads = atoi(dict.find("--exr-threads")->second.c_str());
+                dict.erase("--exr-threads");
+            }
+        }
+
+        if (dict.count("--tile-order")) {
+            try {
+                options.tile_order = traversal_order(dict.find("--tile-order")->second);
+                dict.erase("--tile-order");
+            }
+            catch (const std::invalid_argument&) {
+                options.displayHelp = true;
+                options.displayMessage = "Invalid value for --tile-order.";
+                return options;
+            }
+        }
+
+        if (dict.count("--pixel-order")) {
+            try {
+                options.pixel_order = traversal_order(dict.find("--pixel-order")->second);
+                dict.erase("--pixel-order");
+            }
+            catch (const std::invalid_argument&) {
+                options.displayHelp = true;
+                options.displayMessage = "Invalid value for --pixel-order.";
+                return options;
+            }
+        }
+
         if (options.num_photons == 0) {
             options.num_photons = options.width * options.height;
         }
@@ -1058,6 +1236,69 @@ Options::Technique technique(string technique) {
         throw std::invalid_argument("technique");
 }
 
+string to_string(traversal_order_t order) {
+    switch (order) {
+        case traversal_order_t::linear: return "linear";
+        case traversal_order_t::morton: return "morton";
+        case traversal_order_t::hilbert: return "hilbert";
+        default: return "UNKNOWN";
+    }
+}
+
+traversal_order_t traversal_order(string order) {
+    if (order == "linear")
+        return traversal_order_t::linear;
+    else if (order == "morton")
+        return traversal_order_t::morton;
+    else if (order == "hilbert")
+        return traversal_order_t::hilbert;
+    else
+        throw std::invalid_argument("order");
+}
+
+string to_string(exr_compression_t compression) {
+    switch (compression) {
+        case exr_compression_t::none: return "none";
+        case exr_compression_t::zip: return "zip";
+        case exr_compression_t::piz: return "piz";
+        case exr_compression_t::dwaa: return "dwaa";
+        default: return "UNKNOWN";
+    }
+}
+
+exr_compression_t exr_compression(string compression) {
+    if (compression == "none")
+        return exr_compression_t::none;
+    else if (compression == "zip")
+        return exr_compression_t::zip;
+    else if (compression == "piz")
+        return exr_compression_t::piz;
+    else if (compression == "dwaa")
+        return exr_compression_t::dwaa;
+    else
+        throw std::invalid_argument("compression");
+}
+
+string to_string(bvh_quality_t quality) {
+    switch (quality) {
+        case bvh_quality_t::fast: return "fast";
+        case bvh_quality_t::medium: return "medium";
+        case bvh_quality_t::high: return "high";
+        default: return "UNKNOWN";
+    }
+}
+
+bvh_quality_t bvh_quality(string quality) {
+    if (quality == "fast")
+        return bvh_quality_t::fast;
+    else if (quality == "medium")
+        return bvh_quality_t::medium;
+    else if (quality == "high")
+        return bvh_quality_t::high;
+    else
+        throw std::invalid_argument("quality");
+}
+
 string to_string(const Options::Action& action) {
     switch (action) {
         case Options::Render: return "Render";
@@ -1131,6 +1372,22 @@ Options::Options(const map<string, string>& dict) {
     num_seconds = stod(dict.find("options.num_seconds")->second);
     num_threads = stoll(dict.find("options.num_threads")->second);
     reload = stoi(dict.find("options.reload")->second);
+
+    auto scene_cache_itr = dict.find("options.scene_cache");
+
+    if (scene_cache_itr != dict.end()) {
+      scene_cache = stoi(scene_cache_itr->second);
+    }
+
+    auto bvh_quality_itr = dict.find("options.bvh_quality");
+
+    if (bvh_quality_itr != dict.end()) {
+      bvh_quality = haste::bvh_quality(bvh_quality_itr->second);
+    }
+
+    bvh_compact = safe_bool(dict, "options.bvh_compact");
+    auto_tune = safe_bool(dict, "options.auto_tune");
+    startup_report = safe_bool(dict, "options.startup_report");
     enable_seed = stoi(dict.find("options.enable_seed")->second);
     seed = stoll(dict.find("options.seed")->second);
 
@@ -1157,6 +1414,45 @@ Options::Options(const map<string, string>& dict) {
       sky_zenith = parse_xnotation3f(sky_zenith_itr->second);
     }
 
+    auto light_cache_itr = dict.find("options.light_cache");
+
+    if (light_cache_itr != dict.end()) {
+      light_cache = stoll(light_cache_itr->second);
+    }
+
+    auto spp_per_frame_itr = dict.find("options.spp_per_frame");
+
+    if (spp_per_frame_itr != dict.end()) {
+      spp_per_frame = stoll(spp_per_frame_itr->second);
+    }
+
+    auto tile_order_itr = dict.find("options.tile_order");
+
+    if (tile_order_itr != dict.end()) {
+      tile_order = traversal_order(tile_order_itr->second);
+    }
+
+    auto pixel_order_itr = dict.find("options.pixel_order");
+
+    if (pixel_order_itr != dict.end()) {
+      pixel_order = traversal_order(pixel_order_itr->second);
+    }
+
+    auto exr_compression_itr = dict.find("options.exr_compression");
+
+    if (exr_compression_itr != dict.end()) {
+      exr_compression = haste::exr_compression(exr_compression_itr->second);
+    }
+
+    exr_half = safe_bool(dict, "options.exr_half");
+    checkpoint = safe_bool(dict, "options.checkpoint");
+
+    auto exr_threads_itr = dict.find("options.exr_threads");
+
+    if (exr_threads_itr != dict.end()) {
+      exr_threads = stoll(exr_threads_itr->second);
+    }
+
     const string prefix = "options.trace[";
 
     for (auto&& item : dict) {
@@ -1197,6 +1493,7 @@ map<string, string> Options::to_dict() const
     result["options.num_photons"] = to_string(num_photons);
     result["options.radius"] = to_string(radius);
     result["options.max_path"] = to_string(max_path);
+    result["options.light_cache"] = to_string(light_cache);
     result["options.alpha"] = to_string(alpha);
     result["options.beta"] = to_string(beta);
     result["options.roulette"] = to_string(roulette);
@@ -1208,8 +1505,14 @@ map<string, string> Options::to_dict() const
     result["options.lights"] = to_string(lights);
     result["options.num_samples"] = to_string(num_samples);
     result["options.num_seconds"] = to_string(num_seconds);
+    result["options.spp_per_frame"] = to_string(spp_per_frame);
     result["options.num_threads"] = to_string(num_threads);
     result["options.reload"] = to_string(reload);
+    result["options.scene_cache"] = to_string(scene_cache);
+    result["options.bvh_quality"] = haste::to_string(bvh_quality);
+    result["options.bvh_compact"] = to_string(bvh_compact);
+    result["options.auto_tune"] = to_string(auto_tune);
+    result["options.startup_report"] = to_string(startup_report);
     result["options.enable_seed"] = to_string(enable_seed);
     result["options.enable_ui"] = to_string(enable_ui);
     result["options.seed"] = to_string(seed);
@@ -1219,6 +1522,12 @@ map<string, string> Options::to_dict() const
     result["options.height"] = to_string(height);
     result["options.sky_horizon"] = format_xnotation3f(sky_horizon);
     result["options.sky_zenith"] = format_xnotation3f(sky_zenith);
+    result["options.tile_order"] = haste::to_string(tile_order);
+    result["options.pixel_order"] = haste::to_string(pixel_order);
+    result["options.exr_compression"] = haste::to_string(exr_compression);
+    result["options.exr_half"] = to_string(exr_half);
+    result["options.exr_threads"] = to_string(exr_threads);
+    result["options.checkpoint"] = to_string(checkpoint);
 
     for (size_t i = 0; i < trace.size(); ++i) {
       auto x = std::to_string(trace[i].x);
@@ -1243,38 +1552,58 @@ string Options::get_output() const {
             to_string(technique));
 }
 
-void save_exr(Options options, statistics_t statistics, const vec3* data) {
-  auto metadata = statistics.to_dict();
+exr_format_t Options::exr_format() const {
+    exr_format_t result;
+    result.compression = exr_compression;
+    result.half = exr_half;
+    return result;
+}
+
+// The series (records and measurements) go to the binary sidecar, the
+// image header keeps only the totals and the options.
+map<string, string> fuse_metadata(const Options& options, const statistics_t& statistics) {
+  string sidecar = statistics_path(options.get_output());
+  save_statistics_sidecar(sidecar, statistics);
+
+  auto metadata = statistics.to_dict(false);
   auto local_options = options.to_dict();
   metadata.insert(local_options.begin(), local_options.end());
+  metadata["statistics.sidecar"] = baseName(sidecar);
+
+  auto memory = memory_usage_dict();
+  metadata.insert(memory.begin(), memory.end());
+
+  if (options.startup_report) {
+    auto startup = process_startup_report().to_dict();
+    metadata.insert(startup.begin(), startup.end());
+  }
+
+  return metadata;
+}
+
+void save_exr(Options options, statistics_t statistics, const vec3* data) {
+  auto metadata = fuse_metadata(options, statistics);
 
   if (isfile(options.output)) {
     string temp = temppath(".exr");
-    save_exr(temp, metadata, options.width, options.height, data);
+    save_exr(temp, metadata, options.width, options.height, data, options.exr_format());
     move_file(temp, options.get_output());
   }
   else {
-    save_exr(options.get_output(), metadata, options.width, options.height, data);
+    save_exr(options.get_output(), metadata, options.width, options.height, data, options.exr_format());
   }
 }
 
-map<string, string> fuse_metadata(const Options& options, const statistics_t& statistics) {
-  auto metadata = statistics.to_dict();
-  auto local_options = options.to_dict();
-  metadata.insert(local_options.begin(), local_options.end());
-  return metadata;
-}
-
 void save_exr(Options options, statistics_t statistics, const vec4* data) {
   auto metadata = fuse_metadata(options, statistics);
 
   if (isfile(options.output)) {
     string temp = temppath(".exr");
-    save_exr(temp, metadata, options.width, options.height, data);
+    save_exr(temp, metadata, options.width, options.height, data, options.exr_format());
     move_file(temp, options.get_output());
   }
   else {
-    save_exr(options.get_output(), metadata, options.width, options.height, data);
+    save_exr(options.get_output(), metadata, options.width, options.height, data, options.exr_format());
   }
 }
 
@@ -1313,7 +1642,7 @@ void strip_exr(string dst, string src) {
   load_exr(src, metadata, width, height, data);
 
   auto options = Options(metadata);
-  auto statistics = statistics_t(metadata);
+  auto statistics = load_statistics(src, metadata);
 
   options.output = fullpath(dst);
   options.input1 = fullpath(src);
@@ -1328,84 +1657,147 @@ void strip_exr(string dst, string src) {
 
   if (records.size() != 0) {
     records.erase(records.begin(), records.end() - 1);
+    records.back().frame_duration = float(rendering_duration);
   }
 
-  statistics.records.back().frame_duration = rendering_duration;
-
   statistics.measurements.clear();
 
   save_exr(options, statistics, data.data());
 }
 
-void merge_exr(string dst, string fst, string snd) {
-  vector<vec4> dst_data, fst_data, snd_data;
-  map<string, string> fst_metadata, snd_metadata;
+void load_partial(string path, partial_t& partial) {
+  string checkpoint_file = checkpoint_path(path);
 
-  size_t fst_width = 0, snd_width = 0, fst_height = 0, snd_height = 0;
+  if (isfile(checkpoint_file)) {
+    checkpoint_t checkpoint;
+    load_checkpoint(checkpoint_file, checkpoint);
+    partial.options = Options(checkpoint.metadata);
+    partial.statistics = std::move(checkpoint.statistics);
+    partial.data = std::move(checkpoint.data);
+  }
+  else {
+    vector<vec4> data;
+    map<string, string> metadata;
+    size_t width = 0, height = 0;
+
+    load_exr(path, metadata, width, height, data);
+
+    partial.options = Options(metadata);
+
+    if (partial.options.exr_half) {
+      throw std::runtime_error(path + " was saved with --exr-half and has no checkpoint, it can't be merged.");
+    }
 
-  load_exr(fst, fst_metadata, fst_width, fst_height, fst_data);
-  load_exr(snd, snd_metadata, snd_width, snd_height, snd_data);
+    partial.statistics = load_statistics(path, metadata);
+    partial.data.resize(data.size());
 
-  if (fst_width != snd_width || fst_height != snd_height) {
-    throw std::runtime_error("Sizes of '" + fst + "' and '" + snd +
-      "' doesn't match.");
+    std::transform(
+      data.begin(),
+      data.end(),
+      partial.data.begin(),
+      [](vec4 x) { return dvec4(x); });
+  }
+}
+
+void merge_partials(
+  Options& options,
+  statistics_t& statistics,
+  vector<dvec4>& data,
+  const vector<const partial_t*>& partials) {
+  if (partials.empty()) {
+    throw std::runtime_error("Nothing to merge.");
   }
 
-  dst_data.resize(fst_data.size());
+  const partial_t& fst = *partials.front();
 
-  for (size_t i = 0; i < fst_data.size(); ++i) {
-    dst_data[i] = fst_data[i] + snd_data[i];
+  for (auto&& partial : partials) {
+    if (partial->data.size() != fst.data.size()) {
+      throw std::runtime_error("Sizes of the merged images doesn't match.");
+    }
+
+    if (partial->options.technique != fst.options.technique) {
+      throw std::runtime_error("Cannot merge images rendered using different techniques.");
+    }
   }
 
-  auto fst_options = Options(fst_metadata);
-  auto snd_options = Options(snd_metadata);
-  auto fst_statistics = statistics_t(fst_metadata);
-  auto snd_statistics = statistics_t(snd_metadata);
+  options = fst.options;
+  statistics = fst.statistics;
+  data = fst.data;
 
-  if (fst_options.technique != snd_options.technique) {
-    std::cerr << "Cannot merge images rendered using different techniques." << std::endl;
-    return;
+  double rendering_duration = 0;
+
+  for (auto&& record : fst.statistics.records) {
+    rendering_duration += record.frame_duration;
   }
 
-  fst_options.output = dst;
+  for (size_t i = 1; i < partials.size(); ++i) {
+    const partial_t& snd = *partials[i];
 
-  auto& fst_records = fst_statistics.records;
-  auto& snd_records = snd_statistics.records;
+    for (size_t j = 0; j < data.size(); ++j) {
+      data[j] += snd.data[j];
+    }
 
-  double rendering_duration = 0;
+    for (auto&& record : snd.statistics.records) {
+      rendering_duration += record.frame_duration;
+    }
 
-  for (size_t i = 0; i < fst_records.size(); ++i) {
-    rendering_duration += fst_records[i].frame_duration;
+    statistics.num_samples += snd.statistics.num_samples;
+    statistics.num_basic_rays += snd.statistics.num_basic_rays;
+    statistics.num_shadow_rays += snd.statistics.num_shadow_rays;
+    statistics.num_tentative_rays += snd.statistics.num_tentative_rays;
+    statistics.num_photons += snd.statistics.num_photons;
+    statistics.num_scattered += snd.statistics.num_scattered;
+    statistics.num_queries += snd.statistics.num_queries;
+    statistics.num_merges += snd.statistics.num_merges;
+    statistics.total_time += snd.statistics.total_time;
+    statistics.scatter_time += snd.statistics.scatter_time;
+    statistics.build_time += snd.statistics.build_time;
+    statistics.gather_time += snd.statistics.gather_time;
+    statistics.merge_time += snd.statistics.merge_time;
+    statistics.density_time += snd.statistics.density_time;
+    statistics.intersect_time += snd.statistics.intersect_time;
+    statistics.trace_eye_time += snd.statistics.trace_eye_time;
+    statistics.trace_light_time += snd.statistics.trace_light_time;
+    statistics.accel_build_time += snd.statistics.accel_build_time;
   }
 
-  for (size_t i = 0; i < snd_records.size(); ++i) {
-    rendering_duration += snd_records[i].frame_duration;
+  auto& records = statistics.records;
+
+  if (records.size() != 0) {
+    records.erase(records.begin(), records.end() - 1);
+    records.back().frame_duration = float(rendering_duration);
   }
 
-  if (fst_records.size() != 0) {
-    fst_records.erase(fst_records.begin(), fst_records.end() - 1);
+  statistics.measurements.clear();
+}
+
+void merge_exr(string dst, const vector<string>& inputs) {
+  vector<partial_t> partials(inputs.size());
+  vector<const partial_t*> pointers;
+
+  Options options;
+  statistics_t statistics;
+  vector<dvec4> data;
+
+  try {
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      load_partial(inputs[i], partials[i]);
+      pointers.push_back(&partials[i]);
+    }
+
+    merge_partials(options, statistics, data, pointers);
   }
+  catch (const std::runtime_error& error) {
+    std::cerr << error.what() << std::endl;
+    return;
+  }
+
+  options.output = dst;
+  save_exr(options, statistics, data.data());
+}
 
-  fst_statistics.num_samples += snd_statistics.num_samples;
-  fst_statistics.num_basic_rays += snd_statistics.num_basic_rays;
-  fst_statistics.num_shadow_rays += snd_statistics.num_shadow_rays;
-  fst_statistics.num_tentative_rays += snd_statistics.num_tentative_rays;
-  fst_statistics.num_photons += snd_statistics.num_photons;
-  fst_statistics.num_scattered += snd_statistics.num_scattered;
-  fst_statistics.total_time += snd_statistics.total_time;
-  fst_statistics.scatter_time += snd_statistics.scatter_time;
-  fst_statistics.build_time += snd_statistics.build_time;
-  fst_statistics.gather_time += snd_statistics.gather_time;
-  fst_statistics.merge_time += snd_statistics.merge_time;
-  fst_statistics.density_time += snd_statistics.density_time;
-  fst_statistics.intersect_time += snd_statistics.intersect_time;
-  fst_statistics.trace_eye_time += snd_statistics.trace_eye_time;
-  fst_statistics.trace_light_time += snd_statistics.trace_light_time;
-
-  fst_statistics.records.back().frame_duration = rendering_duration;
-  fst_statistics.measurements.clear();
-
-  save_exr(fst_options, fst_statistics, dst_data.data());
+void merge_exr(string dst, string fst, string snd) {
+  merge_exr(dst, vector<string>({ fst, snd }));
 }
 
 }
@@ -5,7 +5,9 @@
 #include <map>
 #include <glm>
 
+#include <exr.hpp>
 #include <statistics.hpp>
+#include <threadpool.hpp>
 
 namespace haste {
 
@@ -16,6 +18,10 @@ using std::map;
 
 template <class T> using shared = std::shared_ptr<T>;
 
+// Embree builder of the scene BVH: fast (Morton), medium (SAH) or high
+// (SAH with spatial splits).
+enum class bvh_quality_t { fast, medium, high };
+
 struct Options {
     enum Technique { PT, BPT, VCM, UPG, Viewer };
     enum Action {
@@ -31,7 +37,9 @@ struct Options {
     Action action = Render;
     size_t num_photons = 0;
     double radius = 0.01;
+    bool auto_tune = false;
     size_t max_path = PTRDIFF_MAX;
+    size_t light_cache = 0;
     double alpha = 0.75f;
     double beta = 1.0f;
     double roulette = 0.9;
@@ -42,9 +50,14 @@ struct Options {
     bool from_light = true;
     float lights = 1.0f;
     size_t num_samples = 0;
+    size_t spp_per_frame = 1;
     double num_seconds = 0.0;
     size_t num_threads = 1;
     bool reload = true;
+    bool scene_cache = true;
+    bvh_quality_t bvh_quality = bvh_quality_t::high;
+    bool bvh_compact = false;
+    bool startup_report = false;
     bool enable_seed = false;
     bool enable_ui = true;
     size_t seed = 0;
@@ -55,6 +68,13 @@ struct Options {
 	vector<ivec3> trace;
     vec3 sky_horizon = vec3(0);
     vec3 sky_zenith = vec3(0);
+    traversal_order_t tile_order = traversal_order_t::linear;
+    traversal_order_t pixel_order = traversal_order_t::linear;
+    exr_compression_t exr_compression = exr_compression_t::zip;
+    bool exr_half = false;
+    size_t exr_threads = 0;
+    bool checkpoint = false;
+    size_t num_workers = 0;
 
     bool displayHelp = false;
     bool displayVersion = false;
@@ -68,6 +88,7 @@ struct Options {
 
     map<string, string> to_dict() const;
     string get_output() const;
+    exr_format_t exr_format() const;
 };
 
 std::multimap<string, string> extractOptions(int argc, char const* const* argv);
@@ -81,12 +102,34 @@ pair<bool, int> displayHelpIfNecessary(
     const char* version = nullptr);
 
 string to_string(const Options::Technique& technique);
+string to_string(traversal_order_t order);
+traversal_order_t traversal_order(string order);
+string to_string(exr_compression_t compression);
+exr_compression_t exr_compression(string compression);
+string to_string(bvh_quality_t quality);
+bvh_quality_t bvh_quality(string quality);
 
 void save_exr(Options options, statistics_t statistics, const vec3* data);
 void save_exr(Options options, statistics_t statistics, const vec4* data);
 void save_exr(Options options, statistics_t statistics, const dvec3* data);
 void save_exr(Options options, statistics_t statistics, const dvec4* data);
 void strip_exr(string dst, string src);
+
+// A partial result of a render, loaded from its checkpoint when there is
+// one (full precision), from the image otherwise.
+struct partial_t {
+  Options options;
+  statistics_t statistics;
+  vector<dvec4> data;
+};
+
+void load_partial(string path, partial_t& partial);
+void merge_partials(
+  Options& options,
+  statistics_t& statistics,
+  vector<dvec4>& data,
+  const vector<const partial_t*>& partials);
+void merge_exr(string dst, const vector<string>& inputs);
 void merge_exr(string dst, string fst, string snd);
 
 using options_t = Options;
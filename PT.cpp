@@ -44,30 +44,33 @@ vec3 PathTracing::_traceEye(render_context_t& context, Ray ray) {
         _scene->sampleBSDF(*context.generator, eye[prv].surface, eye[prv].omega);
 
     while (true) {
-      surface = _scene->intersect(surface, bsdf.omega);
+      auto hit = _scene->castRay(surface, bsdf.omega);
 
-      if (!surface.is_present()) {
+      if (!hit.is_present()) {
         return radiance;
       }
 
-      eye[itr].surface = surface;
       eye[itr].omega = -bsdf.omega;
 
-      auto edge = Edge(eye[prv].surface, eye[itr].surface, eye[itr].omega);
-
-      eye[itr].throughput =
-          eye[prv].throughput * bsdf.throughput * edge.bCosTheta;
+      // The throughput and the roulette need only the frame of the previous
+      // vertex, the frame of the hit is built for the vertices that are used.
+      eye[itr].throughput = eye[prv].throughput * bsdf.throughput *
+                            abs(dot(bsdf.omega, eye[prv].surface.normal()));
 
       if (l1Norm(eye[itr].throughput) < FLT_EPSILON) {
         return radiance;
       }
 
       eye[itr].throughput /= bsdf.density;
-
       eye[prv].finite = bsdf.finite;
-      eye[itr].density = eye[prv].density * edge.fGeometry * bsdf.density;
 
-      if (surface.is_light()) {
+      if (_scene->isLight(hit)) {
+        surface = _scene->querySurface(hit);
+        eye[itr].surface = surface;
+
+        auto edge = Edge(eye[prv].surface, eye[itr].surface, eye[itr].omega);
+        eye[itr].density = eye[prv].density * edge.fGeometry * bsdf.density;
+
         auto lsdf = _scene->queryLSDF(eye[itr].surface, eye[itr].omega);
         float weightInv = pow(lsdf.density, _beta) /
                               pow(edge.fGeometry * bsdf.density, _beta) +
@@ -77,21 +80,30 @@ vec3 PathTracing::_traceEye(render_context_t& context, Ray ray) {
 
         radiance += lsdf.radiance * eye[itr].throughput / weightInv;
       } else {
+        // The vertex would be the last one, nothing is connected to it.
+        if (path_size == _max_path) {
+          return radiance;
+        }
+
+        float roulette = path_size < _min_subpath ? 1.0f : _roulette;
+        float uniform = context.generator->sample();
+
+        if (roulette < uniform) {
+          return radiance;
+        }
+
+        surface = _scene->querySurface(hit);
+        eye[itr].surface = surface;
+
+        auto edge = Edge(eye[prv].surface, eye[itr].surface, eye[itr].omega);
+        eye[itr].density = eye[prv].density * edge.fGeometry * bsdf.density;
+        eye[itr].throughput /= roulette;
         break;
       }
     }
 
     std::swap(itr, prv);
-
-    float roulette = path_size < _min_subpath ? 1.0f : _roulette;
-    float uniform = context.generator->sample();
-
-    if (roulette < uniform) {
-      return radiance;
-    } else {
-      eye[prv].throughput /= roulette;
-      ++path_size;
-    }
+    ++path_size;
   }
 
   return radiance;
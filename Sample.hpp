@@ -1,6 +1,7 @@
 #pragma once
 #include <glm>
 #include <random>
+#include <string>
 
 namespace haste {
 
@@ -21,6 +22,9 @@ struct random_generator_t {
 
   void seed(std::size_t seed);
 
+  std::string state() const;
+  void set_state(const std::string& state);
+
  private:
   std::mt19937 engine;
 
@@ -1,3 +1,4 @@
+#include <sstream>
 #include <Sample.hpp>
 
 namespace haste {
@@ -277,4 +278,15 @@ std::uint_fast32_t random_generator_t::operator()() {
 
 void random_generator_t::seed(std::size_t seed) { engine.seed(seed); }
 
+std::string random_generator_t::state() const {
+  std::ostringstream stream;
+  stream << engine;
+  return stream.str();
+}
+
+void random_generator_t::set_state(const std::string& state) {
+  std::istringstream stream(state);
+  stream >> engine;
+}
+
 }
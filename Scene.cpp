@@ -1,123 +1,318 @@
 #include <Scene.hpp>
-#include <cstring>
+#include <ostream>
 #include <runtime_assert>
+#include <unittest>
 #include <streamops.hpp>
 
 namespace haste {
 
 Scene::Scene(Cameras&& cameras, Materials&& materials, vector<Mesh>&& meshes,
-             AreaLights&& areaLights)
+             AreaLights&& areaLights, vector<Mesh>&& prototypes,
+             vector<Instance>&& instances)
     : _cameras(cameras),
       meshes(move(meshes)),
       lights(move(areaLights)),
-      materials(move(materials)) {
+      materials(move(materials)),
+      prototypes(move(prototypes)),
+      instances(move(instances)) {
   rtcScene = nullptr;
 
+  for (auto&& instance : this->instances) {
+    runtime_assert(instance.prototype < this->prototypes.size());
+    _normal_matrices.push_back(transpose(inverse(mat3(instance.transform))));
+  }
+
+  size_t mesh_bytes = 0;
+
+  for (auto* list : {&this->meshes, &this->prototypes}) {
+    for (auto&& mesh : *list) {
+      mesh_bytes += mesh.indices.capacity() * sizeof(mesh.indices[0]) +
+                    mesh.vertices.capacity() * sizeof(mesh.vertices[0]) +
+                    mesh.tangents.capacity() * sizeof(mesh.tangents[0]);
+    }
+  }
+
+  _meshMemory.reset(mesh_bytes);
+
   _numIntersectRays = 0;
   _numOccludedRays = 0;
 }
 
-unsigned makeRTCMesh(RTCScene rtcScene, size_t i, const vector<Mesh>& meshes) {
-  unsigned geomID = rtcNewTriangleMesh(rtcScene, RTC_GEOMETRY_STATIC,
-                                       meshes[i].indices.size() / 3,
-                                       meshes[i].vertices.size(), 1);
-
-  vec4* vbuffer = (vec4*)rtcMapBuffer(rtcScene, geomID, RTC_VERTEX_BUFFER);
+Scene::~Scene() {
+  // The instances reference the prototype scenes, they go first.
+  if (rtcScene != nullptr) {
+    rtcDeleteScene(rtcScene);
+  }
 
-  for (size_t j = 0; j < meshes[i].vertices.size(); ++j) {
-    vbuffer[j].x = meshes[i].vertices[j].x;
-    vbuffer[j].y = meshes[i].vertices[j].y;
-    vbuffer[j].z = meshes[i].vertices[j].z;
-    vbuffer[j].w = 1;
+  for (auto prototypeScene : _prototypeScenes) {
+    rtcDeleteScene(prototypeScene);
   }
+}
 
-  rtcUnmapBuffer(rtcScene, geomID, RTC_VERTEX_BUFFER);
+unsigned makeRTCMesh(RTCScene rtcScene, size_t i, const vector<Mesh>& meshes) {
+  const Mesh& mesh = meshes[i];
+  unsigned geomID = 0;
 
-  int* triangles = (int*)rtcMapBuffer(rtcScene, geomID, RTC_INDEX_BUFFER);
-  std::memcpy(triangles, meshes[i].indices.data(),
-              meshes[i].indices.size() * sizeof(int));
+  if (mesh.quads) {
+    geomID = rtcNewQuadMesh(rtcScene, RTC_GEOMETRY_STATIC,
+                            mesh.indices.size() / 4, mesh.vertices.size(), 1);
+  } else {
+    geomID = rtcNewTriangleMesh(rtcScene, RTC_GEOMETRY_STATIC,
+                                mesh.indices.size() / 3, mesh.vertices.size(),
+                                1);
+  }
 
-  rtcUnmapBuffer(rtcScene, geomID, RTC_INDEX_BUFFER);
+  // The buffers are not modified while the rtcScene exists, and move with
+  // it when a reloaded scene takes it over (see buildAccelStructs).
+  rtcSetBuffer(rtcScene, geomID, RTC_VERTEX_BUFFER, mesh.vertices.data(), 0,
+               sizeof(vec4));
+  rtcSetBuffer(rtcScene, geomID, RTC_INDEX_BUFFER, mesh.indices.data(), 0,
+               (mesh.quads ? 4 : 3) * sizeof(int));
 
-  rtcSetMask(rtcScene, geomID, 1u << (meshes[i].material_id & 3u));
+  rtcSetMask(rtcScene, geomID, 1u << (mesh.material_id & 3u));
 
   return geomID;
 }
 
-void updateRTCScene(RTCScene& rtcScene, RTCDevice device, const Scene& scene) {
-  if (rtcScene) {
-    rtcDeleteScene(rtcScene);
-  }
-
-  rtcScene = rtcDeviceNewScene(
-      device, RTC_SCENE_STATIC | RTC_SCENE_HIGH_QUALITY, RTC_INTERSECT1);
+RTCScene newRTCScene(RTCDevice device, RTCSceneFlags flags) {
+  RTCScene rtcScene = rtcDeviceNewScene(device, flags, RTC_INTERSECT1);
 
   if (rtcScene == nullptr) {
     throw std::runtime_error("Cannot create RTCScene.");
   }
 
+  return rtcScene;
+}
+
+void buildPrototypeScenes(vector<RTCScene>& prototypeScenes, RTCDevice device,
+                          RTCSceneFlags flags, const Scene& scene) {
+  for (size_t i = 0; i < scene.prototypes.size(); ++i) {
+    prototypeScenes.push_back(newRTCScene(device, flags));
+    makeRTCMesh(prototypeScenes.back(), i, scene.prototypes);
+    rtcCommit(prototypeScenes.back());
+  }
+}
+
+void buildRTCScene(RTCScene& rtcScene, const vector<RTCScene>& prototypeScenes,
+                   RTCDevice device, RTCSceneFlags flags, const Scene& scene) {
+  rtcScene = newRTCScene(device, flags);
+
   for (size_t i = 0; i < scene.meshes.size(); ++i) {
     unsigned geomID = makeRTCMesh(rtcScene, i, scene.meshes);
     runtime_assert(geomID == i,
                    "Geometry ID doesn't correspond to mesh index.");
   }
 
+  for (size_t i = 0; i < scene.instances.size(); ++i) {
+    auto& instance = scene.instances[i];
+    unsigned geomID =
+        rtcNewInstance(rtcScene, prototypeScenes[instance.prototype]);
+
+    runtime_assert(geomID == scene.meshes.size() + i,
+                   "Geometry ID doesn't correspond to instance index.");
+
+    rtcSetTransform(rtcScene, geomID, RTC_MATRIX_COLUMN_MAJOR_ALIGNED16,
+                    &instance.transform[0][0]);
+
+    auto& prototype = scene.prototypes[instance.prototype];
+    rtcSetMask(rtcScene, geomID, 1u << (prototype.material_id & 3u));
+  }
+
   rtcCommit(rtcScene);
 }
 
-void Scene::buildAccelStructs(RTCDevice device) {
-  if (rtcScene == nullptr) {
-    updateRTCScene(rtcScene, device, *this);
-    lights.init(this);
+bool sameGeometry(const vector<Mesh>& a, const vector<Mesh>& b) {
+  if (a.size() != b.size()) {
+    return false;
   }
+
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (a[i].quads != b[i].quads ||
+        (a[i].material_id & 3u) != (b[i].material_id & 3u) ||
+        a[i].indices != b[i].indices || a[i].vertices != b[i].vertices) {
+      return false;
+    }
+  }
+
+  return true;
 }
 
-const BSDF& Scene::queryBSDF(const SurfacePoint& surface) const {
-  runtime_assert(surface.material_index() < materials.bsdfs.size());
-  return *materials.bsdfs[surface.material_index()].get();
+bool sameInstances(const vector<Instance>& a, const vector<Instance>& b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (a[i].prototype != b[i].prototype ||
+        a[i].transform != b[i].transform) {
+      return false;
+    }
+  }
+
+  return true;
 }
 
-SurfacePoint Scene::querySurface(const RayIsect& isect) const {
-  if (!isect.isPresent()) {
-    return SurfacePoint();
+// The Embree scenes reference the buffers of the meshes they were built
+// from, they are handed over together (the contents are equal).
+void swapBuffers(vector<Mesh>& a, vector<Mesh>& b) {
+  for (size_t i = 0; i < a.size(); ++i) {
+    a[i].indices.swap(b[i].indices);
+    a[i].vertices.swap(b[i].vertices);
+  }
+}
+
+void Scene::buildAccelStructs(RTCDevice device, RTCSceneFlags flags,
+                              Scene* previous) {
+  if (rtcScene != nullptr) {
+    return;
+  }
+
+  double start = high_resolution_time();
+
+  bool reusePrototypes = previous != nullptr &&
+                         previous->rtcScene != nullptr &&
+                         previous->_sceneFlags == flags &&
+                         sameGeometry(prototypes, previous->prototypes);
+
+  bool reuseScene = reusePrototypes &&
+                    sameGeometry(meshes, previous->meshes) &&
+                    sameInstances(instances, previous->instances);
+
+  if (reusePrototypes) {
+    swapBuffers(prototypes, previous->prototypes);
+    _prototypeScenes.swap(previous->_prototypeScenes);
   } else {
-    runtime_assert(isect.meshId() < meshes.size());
+    buildPrototypeScenes(_prototypeScenes, device, flags, *this);
+  }
 
-    const float w = 1.f - isect.u - isect.v;
-    auto& mesh = meshes[isect.meshId()];
+  if (reuseScene) {
+    swapBuffers(meshes, previous->meshes);
+    std::swap(rtcScene, previous->rtcScene);
+  } else {
+    buildRTCScene(rtcScene, _prototypeScenes, device, flags, *this);
+  }
 
-    const mat3& t0 = mesh.tangents[mesh.indices[isect.primID * 3 + 0]];
-    const mat3& t1 = mesh.tangents[mesh.indices[isect.primID * 3 + 1]];
-    const mat3& t2 = mesh.tangents[mesh.indices[isect.primID * 3 + 2]];
+  // What was not taken over is released now rather than with the previous
+  // scene, the instances in its top level scene may reference prototype
+  // scenes it no longer owns.
+  if (previous != nullptr) {
+    if (previous->rtcScene != nullptr) {
+      rtcDeleteScene(previous->rtcScene);
+      previous->rtcScene = nullptr;
+    }
 
-    SurfacePoint point;
-    point._position = (vec3&)isect.org + (vec3&)isect.dir * isect.tfar;
+    for (auto prototypeScene : previous->_prototypeScenes) {
+      rtcDeleteScene(prototypeScene);
+    }
 
-    point._tangent = w * t0 + isect.u * t1 + isect.v * t2;
+    previous->_prototypeScenes.clear();
+  }
 
-    point._tangent[1] = normalize(point._tangent[1]);
+  _sceneFlags = flags;
+  loadTimes.bvh = high_resolution_time() - start;
+  process_startup_report().mark("bvh");
 
-    point._tangent[0] =
-        point._tangent[0] -
-        dot(point._tangent[0], point._tangent[1]) * point._tangent[1];
+  start = high_resolution_time();
+  lights.init(this);
+  loadTimes.lights = high_resolution_time() - start;
+  process_startup_report().mark("lights");
+}
 
-    point._tangent[0] = normalize(point._tangent[0]);
+std::ostream& operator<<(std::ostream& stream, const scene_load_times_t& times) {
+  return stream << times.total() << "s (import " << times.import
+                << "s, conversion " << times.conversion << "s, cache "
+                << times.cache << "s, bvh " << times.bvh << "s, lights "
+                << times.lights << "s)";
+}
 
-    point._tangent[2] =
-        point._tangent[2] -
-        dot(point._tangent[2], point._tangent[1]) * point._tangent[1] -
-        dot(point._tangent[2], point._tangent[0]) * point._tangent[0];
+const BSDF& Scene::queryBSDF(const SurfacePoint& surface) const {
+  runtime_assert(surface.material_index() < materials.bsdfs.size());
+  return *materials.bsdfs[surface.material_index()].get();
+}
 
-    point._tangent[2] = normalize(point._tangent[2]);
+SurfacePoint Scene::querySurface(const hit_t& isect) const {
+  if (!isect.is_present()) {
+    return SurfacePoint();
+  } else {
+    auto& mesh = _hitMesh(isect);
 
-    point.gnormal = isect.gnormal();
+    SurfacePoint point;
+    point._position = isect.position();
+
+    // Vertices of the triangle that was hit and their weights.
+    packed_frame_t frames[3];
+    float weights[3];
+
+    if (mesh.quads) {
+      // Embree splits the quad into (0, 1, 3) and (2, 3, 1), u and v span
+      // the whole quad, interpolate linearly over the triangle that was hit.
+      const int* index = mesh.indices.data() + isect.prim_id * 4;
+
+      if (isect.u + isect.v <= 1.0f) {
+        frames[0] = mesh.tangents[index[0]];
+        frames[1] = mesh.tangents[index[1]];
+        frames[2] = mesh.tangents[index[3]];
+        weights[0] = 1.f - isect.u - isect.v;
+        weights[1] = isect.u;
+        weights[2] = isect.v;
+      } else {
+        frames[0] = mesh.tangents[index[2]];
+        frames[1] = mesh.tangents[index[3]];
+        frames[2] = mesh.tangents[index[1]];
+        weights[0] = isect.u + isect.v - 1.f;
+        weights[1] = 1.f - isect.u;
+        weights[2] = 1.f - isect.v;
+      }
+    } else {
+      const int* index = mesh.indices.data() + isect.prim_id * 3;
+      frames[0] = mesh.tangents[index[0]];
+      frames[1] = mesh.tangents[index[1]];
+      frames[2] = mesh.tangents[index[2]];
+      weights[0] = 1.f - isect.u - isect.v;
+      weights[1] = isect.u;
+      weights[2] = isect.v;
+    }
+
+    // Blend the rotations (nlerp, q and -q are the same rotation so align
+    // them first), the result is orthonormal by construction.
+    vec4 q0 = frame_rotation(frames[0]);
+    vec4 q1 = frame_rotation(frames[1]);
+    vec4 q2 = frame_rotation(frames[2]);
+    q1 = dot(q0, q1) < 0.0f ? -q1 : q1;
+    q2 = dot(q0, q2) < 0.0f ? -q2 : q2;
+
+    point._tangent =
+        frame_matrix(weights[0] * q0 + weights[1] * q1 + weights[2] * q2,
+                     frame_handedness(frames[0]));
+
+    point.gnormal = normalize(-isect.gnormal);
+
+    // Embree reports the hits of instances in object space.
+    if (isect.inst_id != RTC_INVALID_GEOMETRY_ID) {
+      size_t instance = isect.inst_id - meshes.size();
+      mat3 linear = mat3(instances[instance].transform);
+      const mat3& normal_matrix = _normal_matrices[instance];
+
+      vec3 normal = normalize(normal_matrix * point._tangent[1]);
+      vec3 tangent = linear * point._tangent[0];
+      tangent = normalize(tangent - dot(tangent, normal) * normal);
+      vec3 bitangent = cross(tangent, normal);
+
+      point._tangent[0] = tangent;
+      point._tangent[1] = normal;
+      point._tangent[2] =
+          dot(bitangent, linear * point._tangent[2]) < 0.0f ? -bitangent
+                                                            : bitangent;
+
+      point.gnormal = normalize(normal_matrix * point.gnormal);
+    }
 
     /*point._tangent[1]
         = normalize(point._tangent[1]
         * (dot(isect.omega(), point._tangent[1]) < 0.0f ? -1.0f : 1.0f));*/
 
     point.gnormal = point.gnormal *
-                    (dot(isect.omega(), point.gnormal) < 0.0f ? -1.0f : 1.0f);
+                    (dot(isect.direction, point.gnormal) > 0.0f ? -1.0f : 1.0f);
 
     point.material_id = mesh.material_id;
 
@@ -179,8 +374,30 @@ float Scene::occluded(const SurfacePoint& origin,
   return rtcRay.geomID == 0 ? 0.f : 1.f;
 }
 
-SurfacePoint Scene::intersect(const SurfacePoint& surface, vec3 direction,
-                              float tfar) const {
+const Mesh& Scene::_hitMesh(const hit_t& hit) const {
+  if (hit.inst_id == RTC_INVALID_GEOMETRY_ID) {
+    runtime_assert(hit.geom_id < meshes.size());
+    return meshes[hit.geom_id];
+  } else {
+    runtime_assert(hit.inst_id - meshes.size() < instances.size());
+    return prototypes[instances[hit.inst_id - meshes.size()].prototype];
+  }
+}
+
+uint32_t Scene::queryMaterial(const hit_t& hit) const {
+  if (!hit.is_present()) {
+    return SurfacePoint().material_id;
+  } else {
+    return _hitMesh(hit).material_id;
+  }
+}
+
+bool Scene::isLight(const hit_t& hit) const {
+  return (queryMaterial(hit) & 3u) == uint32_t(entity_type::light);
+}
+
+hit_t Scene::_castRay(const SurfacePoint& surface, vec3 direction, float tfar,
+                      unsigned mask) const {
   RayIsect rtcRay;
   (*(vec3*)rtcRay.org) =
       surface.position() +
@@ -193,36 +410,45 @@ SurfacePoint Scene::intersect(const SurfacePoint& surface, vec3 direction,
   rtcRay.geomID = RTC_INVALID_GEOMETRY_ID;
   rtcRay.primID = RTC_INVALID_GEOMETRY_ID;
   rtcRay.instID = RTC_INVALID_GEOMETRY_ID;
-  rtcRay.mask = 0xFFFFFFFF;
+  rtcRay.mask = mask;
   rtcRay.time = 0.f;
   rtcIntersect(rtcScene, rtcRay);
 
   ++_numIntersectRays;
 
-  return querySurface(rtcRay);
+  hit_t hit;
+  hit.origin = (vec3&)rtcRay.org;
+  hit.direction = (vec3&)rtcRay.dir;
+  hit.gnormal = (vec3&)rtcRay.Ng;
+  hit.t = rtcRay.tfar;
+  hit.u = rtcRay.u;
+  hit.v = rtcRay.v;
+  hit.geom_id = rtcRay.geomID;
+  hit.prim_id = rtcRay.primID;
+  hit.inst_id = rtcRay.instID;
+
+  return hit;
 }
 
-SurfacePoint Scene::intersectMesh(const SurfacePoint& surface, vec3 direction,
-                                  float tfar) const {
-  RayIsect rtcRay;
-  (*(vec3*)rtcRay.org) =
-      surface.position() +
-      (dot(surface.gnormal, direction) > 0.0f ? 1.0f : -1.0f) *
-          surface.gnormal * 0.0001f;
+hit_t Scene::castRay(const SurfacePoint& surface, vec3 direction,
+                     float tfar) const {
+  return _castRay(surface, direction, tfar, 0xFFFFFFFF);
+}
 
-  (*(vec3*)rtcRay.dir) = direction;
-  rtcRay.tnear = 0.0f;
-  rtcRay.tfar = tfar;
-  rtcRay.geomID = RTC_INVALID_GEOMETRY_ID;
-  rtcRay.primID = RTC_INVALID_GEOMETRY_ID;
-  rtcRay.instID = RTC_INVALID_GEOMETRY_ID;
-  rtcRay.mask = 1u << uint32_t(entity_type::mesh);
-  rtcRay.time = 0.f;
-  rtcIntersect(rtcScene, rtcRay);
+hit_t Scene::castMeshRay(const SurfacePoint& surface, vec3 direction,
+                         float tfar) const {
+  return _castRay(surface, direction, tfar,
+                  1u << uint32_t(entity_type::mesh));
+}
 
-  ++_numIntersectRays;
+SurfacePoint Scene::intersect(const SurfacePoint& surface, vec3 direction,
+                              float tfar) const {
+  return querySurface(castRay(surface, direction, tfar));
+}
 
-  return querySurface(rtcRay);
+SurfacePoint Scene::intersectMesh(const SurfacePoint& surface, vec3 direction,
+                                  float tfar) const {
+  return querySurface(castMeshRay(surface, direction, tfar));
 }
 
 const size_t Scene::numNormalRays() const { return _numIntersectRays; }
@@ -236,4 +462,20 @@ const size_t Scene::numRays() const {
 const LightSample Scene::sampleLight(RandomEngine& engine) const {
   return lights.sample(engine);
 }
+
+unittest() {
+  vec3 normal = normalize(vec3(0.3f, -0.8f, 0.5f));
+  vec3 tangent = normalize(cross(normal, vec3(0.0f, 0.0f, 1.0f)));
+  vec3 bitangent = cross(tangent, normal);
+
+  for (float handedness : {1.0f, -1.0f}) {
+    mat3 frame(tangent, normal, bitangent * handedness);
+    mat3 unpacked = unpack_frame(pack_frame(frame));
+
+    for (int i = 0; i < 3; ++i) {
+      assert_true(distance(unpacked[i], frame[i]) < 1e-3f);
+    }
+  }
+}
+
 }
@@ -1,11 +1,13 @@
 #pragma once
 #include <Intersector.hpp>
 #include <Prerequisites.hpp>
+#include <iosfwd>
 
 #include <AreaLights.hpp>
 #include <BSDF.hpp>
 #include <Cameras.hpp>
 #include <Materials.hpp>
+#include <memory.hpp>
 
 #include <SurfacePoint.hpp>
 
@@ -24,23 +26,63 @@ using std::move;
 
 struct Ray;
 
+// Seconds spent in the stages of loading a scene.
+struct scene_load_times_t {
+  double import = 0.0;      // Assimp, or reading the scene cache
+  double conversion = 0.0;  // meshes, materials, lights and bounds
+  double cache = 0.0;       // writing the scene cache
+  double bvh = 0.0;
+  double lights = 0.0;
+
+  double total() const { return import + conversion + cache + bvh + lights; }
+};
+
+std::ostream& operator<<(std::ostream& stream, const scene_load_times_t& times);
+
 class Scene : public Intersector {
  public:
   Scene(Cameras&& cameras, Materials&& materials, vector<Mesh>&& meshes,
-        AreaLights&& areaLights);
+        AreaLights&& areaLights, vector<Mesh>&& prototypes = vector<Mesh>(),
+        vector<Instance>&& instances = vector<Instance>());
+
+  Scene(const Scene&) = delete;
+  Scene& operator=(const Scene&) = delete;
+  ~Scene();
 
   Cameras _cameras;
-  const vector<Mesh> meshes;
+  vector<Mesh> meshes;
   AreaLights lights;
   const Materials materials;
 
+  // Meshes in object space, placed in the world by the instances. In the
+  // Embree scene the instances follow the meshes (instance i has geometry
+  // id meshes.size() + i) and each prototype has a scene of its own.
+  vector<Mesh> prototypes;
+  const vector<Instance> instances;
+
   const Cameras& cameras() const { return _cameras; }
 
-  void buildAccelStructs(RTCDevice device);
+  // Takes over the BVHs of the previous scene where the geometry they were
+  // built from did not change, e.g. when only materials or lights were
+  // edited, and builds the rest. The previous scene is left without BVHs
+  // and cannot be traced afterwards.
+  void buildAccelStructs(
+      RTCDevice device,
+      RTCSceneFlags flags = RTC_SCENE_STATIC | RTC_SCENE_HIGH_QUALITY,
+      Scene* previous = nullptr);
+
+  // Filled by loadScene and buildAccelStructs.
+  scene_load_times_t loadTimes;
 
   const BSDF& queryBSDF(const SurfacePoint& surface) const;
 
-  SurfacePoint querySurface(const RayIsect& isect) const;
+  SurfacePoint querySurface(const hit_t& hit) const;
+
+  // Material id of the hit, the same as querySurface(hit).material_id.
+  uint32_t queryMaterial(const hit_t& hit) const;
+
+  // The same as querySurface(hit).is_light().
+  bool isLight(const hit_t& hit) const;
 
   const LSDFQuery queryLSDF(const SurfacePoint& surface,
                             const vec3& omega) const;
@@ -58,6 +100,12 @@ class Scene : public Intersector {
 
   using Intersector::intersectMesh;
 
+  hit_t castRay(const SurfacePoint& surface, vec3 direction,
+                float tfar = INFINITY) const;
+
+  hit_t castMeshRay(const SurfacePoint& surface, vec3 direction,
+                    float tfar = INFINITY) const;
+
   const size_t numNormalRays() const;
   const size_t numShadowRays() const;
   const size_t numRays() const;
@@ -71,6 +119,18 @@ class Scene : public Intersector {
                             const vec3& outgoing) const;
 
  private:
+  vector<mat3> _normal_matrices;
+  vector<RTCScene> _prototypeScenes;
+  RTCSceneFlags _sceneFlags = RTC_SCENE_STATIC;
+
+  // Mesh buffers are shared with Embree, so they are accounted as a whole.
+  tracked_bytes_t _meshMemory{memory_tag_t::meshes};
+
+  const Mesh& _hitMesh(const hit_t& hit) const;
+
+  hit_t _castRay(const SurfacePoint& surface, vec3 direction, float tfar,
+                 unsigned mask) const;
+
   int32_t _material_id_to_light_id(int32_t) const;
   int32_t _light_id_to_material_id(int32_t) const;
 };
@@ -3,6 +3,7 @@
 
 namespace haste {
 
+using std::int16_t;
 using std::uint32_t;
 
 enum class entity_type : uint32_t {
@@ -34,6 +35,81 @@ inline vec3 unpack_normal(uint32_t n) {
   return vec3(x, y, z);
 }
 
+// Tangent frame packed to 8 bytes: the rotation taking the canonical basis
+// to the orthonormalized frame as a quaternion in 16 bit snorm. The
+// quaternion is kept in the w > 0 hemisphere and its sign stores the
+// handedness of the frame (column 2 is negated for left-handed frames).
+struct packed_frame_t {
+  int16_t q[4];
+};
+
+inline packed_frame_t pack_frame(const mat3& frame) {
+  vec3 c1 = normalize(frame[1]);
+  vec3 c0 = normalize(frame[0] - dot(frame[0], c1) * c1);
+  vec3 c2 = cross(c0, c1);
+  float handedness = dot(c2, frame[2]) < 0.0f ? -1.0f : 1.0f;
+
+  // m<row><column>
+  float m00 = c0.x, m01 = c1.x, m02 = c2.x;
+  float m10 = c0.y, m11 = c1.y, m12 = c2.y;
+  float m20 = c0.z, m21 = c1.z, m22 = c2.z;
+  float trace = m00 + m11 + m22;
+  vec4 q;
+
+  if (trace > 0.0f) {
+    float s = sqrt(trace + 1.0f) * 2.0f;
+    q = vec4((m21 - m12) / s, (m02 - m20) / s, (m10 - m01) / s, 0.25f * s);
+  } else if (m00 > m11 && m00 > m22) {
+    float s = sqrt(1.0f + m00 - m11 - m22) * 2.0f;
+    q = vec4(0.25f * s, (m01 + m10) / s, (m02 + m20) / s, (m21 - m12) / s);
+  } else if (m11 > m22) {
+    float s = sqrt(1.0f + m11 - m00 - m22) * 2.0f;
+    q = vec4((m01 + m10) / s, 0.25f * s, (m12 + m21) / s, (m02 - m20) / s);
+  } else {
+    float s = sqrt(1.0f + m22 - m00 - m11) * 2.0f;
+    q = vec4((m02 + m20) / s, (m12 + m21) / s, 0.25f * s, (m10 - m01) / s);
+  }
+
+  q = q.w < 0.0f ? -q : q;
+  q.w = max(q.w, 1.0f / 32767.0f);
+  q = normalize(q) * handedness;
+
+  packed_frame_t result;
+
+  for (int i = 0; i < 4; ++i) {
+    result.q[i] = int16_t(round(clamp(q[i], -1.0f, 1.0f) * 32767.0f));
+  }
+
+  return result;
+}
+
+inline float frame_handedness(packed_frame_t frame) {
+  return frame.q[3] < 0 ? -1.0f : 1.0f;
+}
+
+// The (unnormalized) rotation of the frame, in the w > 0 hemisphere.
+inline vec4 frame_rotation(packed_frame_t frame) {
+  return vec4(frame.q[0], frame.q[1], frame.q[2], frame.q[3]) *
+         frame_handedness(frame);
+}
+
+inline mat3 frame_matrix(vec4 q, float handedness) {
+  q = normalize(q);
+  float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+  float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+  float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+  return mat3(
+      vec3(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy)),
+      vec3(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx)),
+      vec3(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy)) *
+          handedness);
+}
+
+inline mat3 unpack_frame(packed_frame_t frame) {
+  return frame_matrix(frame_rotation(frame), frame_handedness(frame));
+}
+
 struct SurfacePoint {
   vec3 _position;
   vec3 gnormal;
@@ -8,6 +8,9 @@ namespace haste {
 Technique::Technique(const shared<const Scene>& scene, size_t num_threads)
     : _scene(scene)
     , _threadpool(num_threads) {
+    if (_scene) {
+        _statistics.accel_build_time = _scene->loadTimes.bvh;
+    }
 }
 
 Technique::~Technique() { }
@@ -23,7 +26,7 @@ void Technique::render(
 
     if (!std::isfinite(_start_time)) {
         double time_offset = _statistics.records.empty()
-            ? 0.0f
+            ? _statistics.total_time
             : _statistics.records.back().clock_time;
 
         _start_time = high_resolution_time() - time_offset;
@@ -45,14 +48,20 @@ void Technique::render(
     context.generator = &generator;
 
     _adjust_helper_image(view);
-    _preprocess(generator, double(_statistics.num_samples));
-    _trace_paths(view, context, cameraId);
+
+    // Each pass has its own preprocessing, the light subpaths and photons
+    // are not shared between samples of a pixel.
+    for (size_t pass = 0; pass < _spp_per_frame; ++pass) {
+        _preprocess(generator, double(_statistics.num_samples + pass));
+        _trace_paths(view, context, cameraId);
+    }
+
     size_t numeric_errors = _commit_images(view);
 
     double current_time = high_resolution_time();
     double elapsed_time = current_time - start_time;
 
-    ++_statistics.num_samples;
+    _statistics.num_samples += _spp_per_frame;
     _statistics.num_basic_rays += _scene->numNormalRays() - num_basic_rays;
     _statistics.num_shadow_rays += _scene->numShadowRays() - num_shadow_rays;
     _statistics.num_tentative_rays += 0;
@@ -65,6 +74,8 @@ void Technique::render(
     record.clock_time = float(_statistics.total_time);
     record.frame_duration = float(elapsed_time);
     record.numeric_errors = numeric_errors;
+    record.num_photons = _statistics.num_photons;
+    record.radius = float(_statistics.radius);
 
     if (!reference.empty()) {
       auto a = image_view_t<dvec4>(view);
@@ -93,6 +104,20 @@ void Technique::set_sky_gradient(vec3 horizon, vec3 zenith) {
     _sky_zenith = zenith;
 }
 
+void Technique::set_traversal_order(traversal_order_t tile, traversal_order_t pixel) {
+    _tile_order = tile;
+    _pixel_order = pixel;
+}
+
+size_t Technique::spp_per_frame() const {
+    return _spp_per_frame;
+}
+
+void Technique::set_spp_per_frame(size_t spp_per_frame) {
+    runtime_assert(spp_per_frame != 0);
+    _spp_per_frame = spp_per_frame;
+}
+
 vec3 Technique::_traceEye(
     render_context_t& context,
     Ray ray)
@@ -154,9 +179,14 @@ unittest() {
 void Technique::_adjust_helper_image(subimage_view_t& view) {
     size_t view_size = view.width() * view.height();
 
-    if (_light_image.size() != view_size) {
-        _light_image.resize(view_size, vec3(0.0f));
-        _eye_image.resize(view_size, vec3(0.0f));
+    // Several samples per frame land in the same eye pixel, let them be
+    // compensated as well.
+    bool compensate_eye = _spp_per_frame > 1;
+
+    if (_light_image.size() != view_size ||
+        (compensate_eye && !_eye_image.compensated)) {
+        _light_image.resize(view_size, true);
+        _eye_image.resize(view_size, compensate_eye);
     }
 }
 
@@ -164,10 +194,17 @@ void Technique::_trace_paths(
     subimage_view_t& view,
     render_context_t& context,
     size_t cameraId) {
-    exec2d(_threadpool, view.xWindow(), view.yWindow(), 32,
+    // The tile generators are seeded from the frame generator and the tile
+    // position, so a render with a seeded main generator is reproducible
+    // with any number of threads.
+    uint32_t frame_seed = _threadpool.num_threads() > 1 ? uint32_t((*context.generator)()) : 0;
+    std::atomic<size_t> num_queries(0);
+    std::atomic<size_t> num_merges(0);
+
+    exec2d(_threadpool, view.xWindow(), view.yWindow(), 32, _tile_order,
         [&](size_t x0, size_t x1, size_t y0, size_t y1) {
         render_context_t local_context = context;
-        random_generator_t generator;
+        random_generator_t generator(frame_seed + uint32_t(y0 * view.xWindow() + x0) * 0x9E3779B9u);
 
         if (_threadpool.num_threads() > 1) {
             local_context.generator = &generator;
@@ -188,7 +225,13 @@ void Technique::_trace_paths(
         subview._yWindow = yEnd - yBegin;
 
         _for_each_ray(subview, local_context);
+
+        num_queries += local_context.num_queries;
+        num_merges += local_context.num_merges;
     });
+
+    _statistics.num_queries += num_queries;
+    _statistics.num_merges += num_merges;
 }
 
 size_t Technique::_commit_images(subimage_view_t& view) {
@@ -213,27 +256,43 @@ size_t Technique::_commit_images(subimage_view_t& view) {
         size_t local_errors = 0;
 
         for (size_t y = subview.yBegin(); y < subview.yEnd(); ++y) {
-            dvec4* dst_begin = subview.data() + y * subview.width() + subview.xBegin();
-            dvec4* dst_end = dst_begin + subview.xWindow();
-            dvec3* light_itr = _light_image.data() + y * subview.width() + subview.xBegin();
-            dvec3* eye_itr = _eye_image.data() + y * subview.width() + subview.xBegin();
-
-            for (dvec4* dst_itr = dst_begin; dst_itr < dst_end; ++dst_itr) {
-                dvec4 new_dst = *dst_itr + dvec4(*light_itr + *eye_itr, 1.0f);
-
-                if (std::isfinite(l1Norm(*light_itr + *eye_itr))) {
-                    *dst_itr = new_dst;
-                }
-                else {
-                    ++local_errors;
-                    std::cerr << "Numeric error." << std::endl;
-                }
-
-                *light_itr = dvec3(0.0f);
-                *eye_itr = dvec3(0.0f);
-                ++light_itr;
-                ++eye_itr;
+            size_t begin = y * subview.width() + subview.xBegin();
+            size_t end = begin + subview.xWindow();
+
+            _light_image.fold(begin, end);
+            _eye_image.fold(begin, end);
+
+            dvec4* __restrict dst = subview.data();
+            const float* __restrict eye_r = _eye_image.r.data();
+            const float* __restrict eye_g = _eye_image.g.data();
+            const float* __restrict eye_b = _eye_image.b.data();
+            const float* __restrict light_r = _light_image.r.data();
+            const float* __restrict light_g = _light_image.g.data();
+            const float* __restrict light_b = _light_image.b.data();
+
+            const double spp = double(_spp_per_frame);
+            size_t row_errors = 0;
+
+            for (size_t i = begin; i < end; ++i) {
+                double r = double(eye_r[i]) + double(light_r[i]);
+                double g = double(eye_g[i]) + double(light_g[i]);
+                double b = double(eye_b[i]) + double(light_b[i]);
+                bool finite = std::isfinite(r + g + b);
+
+                row_errors += finite ? 0 : 1;
+                dst[i].x += finite ? r : 0.0;
+                dst[i].y += finite ? g : 0.0;
+                dst[i].z += finite ? b : 0.0;
+                dst[i].w += finite ? spp : 0.0;
             }
+
+            if (row_errors != 0) {
+                std::cerr << "Numeric error." << std::endl;
+                local_errors += row_errors;
+            }
+
+            _light_image.clear(begin, end);
+            _eye_image.clear(begin, end);
         }
 
         std::unique_lock<std::mutex> lock(_light_mutex);
@@ -296,7 +355,7 @@ vec3 Technique::_accumulate(
 
         vec3 result = callback(closure);
         std::unique_lock<std::mutex> lock(_light_mutex);
-        _light_image[iposition.y * width + iposition.x] += result;
+        _light_image.add(iposition.y * width + iposition.x, result);
 
         return vec3(0.0f, 0.0f, 0.0f);
     }
@@ -330,12 +389,34 @@ void Technique::_for_each_ray(
         return { context.camera_position, context.view_to_world_mat3 * direction };
     };
 
+    if (_pixel_order != traversal_order_t::linear) {
+        const size_t xWindow = view.xWindow();
+        const size_t yWindow = view.yWindow();
+        const size_t side = traversal_side(xWindow, yWindow);
+
+        for (size_t d = 0; d < side * side; ++d) {
+            size_t dx = 0, dy = 0;
+            traversal_decode(_pixel_order, side, d, dx, dy);
+
+            if (dx < xWindow && dy < yWindow) {
+                const int x = xBegin + int(dx);
+                const int y = yBegin + int(dy);
+                const Ray ray = shoot(float(x), float(y));
+                context.pixel_position = vec2(x, y);
+                context.pixel_index = y * view.width() + x;
+                _eye_image.add(y * view.width() + x, _traceEye(context, ray));
+            }
+        }
+
+        return;
+    }
+
     for (int y = yBegin; y < yEnd; ++y) {
         for (int x = xBegin; x < xEnd; ++x) {
             const Ray ray = shoot(float(x), float(y));
             context.pixel_position = vec2(x, y);
             context.pixel_index = y * view.width() + x;
-            _eye_image[y * view.width() + x] += _traceEye(context, ray);
+            _eye_image.add(y * view.width() + x, _traceEye(context, ray));
         }
 
         ++y;
@@ -345,7 +426,7 @@ void Technique::_for_each_ray(
                 const Ray ray = shoot(float(x), float(y));
                 context.pixel_position = vec2(x, y);
                 context.pixel_index = y * view.width() + x;
-                _eye_image[y * view.width() + x] += _traceEye(context, ray);
+                _eye_image.add(y * view.width() + x, _traceEye(context, ray));
             }
         }
     }
@@ -24,6 +24,10 @@ struct render_context_t {
     RandomEngine* generator;
     vec2 pixel_position;
     std::size_t pixel_index;
+
+    // Photon gather queries and merges, summed per tile into the statistics.
+    std::size_t num_queries = 0;
+    std::size_t num_merges = 0;
 };
 
 class Technique {
@@ -39,18 +43,24 @@ public:
         const vector<ivec3>& trace_points);
 
     const statistics_t& statistics() const;
-    void set_statistics(const statistics_t& statistics);
+    virtual void set_statistics(const statistics_t& statistics);
     vec3 sky_gradient(vec3 omega) const;
     void set_sky_gradient(vec3 horizon, vec3 zenith);
+    void set_traversal_order(traversal_order_t tile, traversal_order_t pixel);
+    size_t spp_per_frame() const;
+    void set_spp_per_frame(size_t spp_per_frame);
 protected:
     vec3 _sky_horizon = vec3(0);
     vec3 _sky_zenith = vec3(0);
+    traversal_order_t _tile_order = traversal_order_t::linear;
+    traversal_order_t _pixel_order = traversal_order_t::linear;
+    size_t _spp_per_frame = 1;
 
     double _start_time = NAN;
     statistics_t _statistics;
     shared<const Scene> _scene;
-    std::vector<dvec3> _eye_image;
-    std::vector<dvec3> _light_image;
+    planar_image_t _eye_image;
+    planar_image_t _light_image;
     std::mutex _light_mutex;
 
     threadpool_t _threadpool;
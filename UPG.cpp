@@ -1,5 +1,6 @@
 #include <UPG.hpp>
 #include <condition_variable>
+#include <memory>
 #include <streamops.hpp>
 
 namespace haste {
@@ -14,12 +15,14 @@ UPGBase<Beta>::UPGBase(
   float lights,
   float roulette,
   size_t numPhotons,
+  bool auto_tune,
   float radius,
   float alpha,
   float beta,
   size_t num_threads)
   : Technique(scene, num_threads)
   , _num_photons(numPhotons)
+  , _auto_tune(auto_tune)
   , _unbiased(unbiased)
   , _enable_vc(enable_vc)
   , _enable_vm(enable_vm)
@@ -69,9 +72,9 @@ vec3 UPGBase<Beta>::_traceEye(render_context_t& context, Ray ray) {
     }
 
     while (true) {
-      surface = _scene->intersect(surface, bsdf.omega);
+      auto hit = _scene->castRay(surface, bsdf.omega);
 
-      if (!surface.is_present()) {
+      if (!hit.is_present()) {
         if (prv->surface.is_camera()) {
           return sky_gradient(bsdf.omega) *= _roulette_inv;
         }
@@ -79,18 +82,14 @@ vec3 UPGBase<Beta>::_traceEye(render_context_t& context, Ray ray) {
         return radiance;
       }
 
-      itr->surface = surface;
       itr->omega = -bsdf.omega;
 
-
-      new_bsdf = _scene->sampleBSDF(*context.generator, itr->surface, itr->omega);
-
-      auto edge = Edge(prv->surface, itr->surface, itr->omega);
-
+      // Every vertex is gathered at, only a path without throughput ends
+      // before the frame of the hit is needed.
       itr->throughput
         = prv->throughput
         * bsdf.throughput
-        * edge.bCosTheta;
+        * abs(dot(bsdf.omega, prv->surface.normal()));
 
       if (l1Norm(itr->throughput) < FLT_EPSILON) {
         return radiance;
@@ -98,6 +97,13 @@ vec3 UPGBase<Beta>::_traceEye(render_context_t& context, Ray ray) {
 
       itr->throughput /= bsdf.density;
 
+      surface = _scene->querySurface(hit);
+      itr->surface = surface;
+
+      new_bsdf = _scene->sampleBSDF(*context.generator, itr->surface, itr->omega);
+
+      auto edge = Edge(prv->surface, itr->surface, itr->omega);
+
       itr->bGeometry = edge.bGeometry;
       itr->length = prv->length + 1;
 
@@ -175,6 +181,10 @@ vec3 UPGBase<Beta>::_traceEye(render_context_t& context, Ray ray) {
 
 template <class Beta>
 void UPGBase<Beta>::_preprocess(random_generator_t& generator, double num_samples) {
+  if (_auto_tune) {
+    _tune_photons();
+  }
+
   time_scope_t _0(_statistics.scatter_time);
 
   if (!_unbiased) {
@@ -207,7 +217,7 @@ typename UPGBase<Beta>::LightVertex UPGBase<Beta>::_sample_light(random_generato
 }
 
 template <class Beta>
-void UPGBase<Beta>::_traceLight(random_generator_t& generator, vector<LightVertex>& path, size_t& size) {
+void UPGBase<Beta>::_traceLight(random_generator_t& generator, light_paths_t& path, size_t& size) {
   if (_russian_roulette(generator)) {
     return;
   }
@@ -224,23 +234,18 @@ void UPGBase<Beta>::_traceLight(random_generator_t& generator, vector<LightVerte
   BSDFSample new_bsdf;
 
   while (!_russian_roulette(generator)) {
-    auto surface = _scene->intersectMesh(prv->surface, bsdf.omega);
+    auto hit = _scene->castMeshRay(prv->surface, bsdf.omega);
 
-    if (!surface.is_present()) {
+    if (!hit.is_present()) {
       break;
     }
 
-    itr->surface = surface;
     itr->omega = -bsdf.omega;
 
-    new_bsdf = _scene->sampleBSDF(generator, itr->surface, itr->omega);
-
-    auto edge = Edge(prv->surface, itr->surface, itr->omega);
-
     itr->throughput
       = prv->throughput
       * bsdf.throughput
-      * edge.bCosTheta
+      * abs(dot(bsdf.omega, prv->surface.normal()))
       * _roulette_inv;
 
     if (l1Norm(itr->throughput) < FLT_EPSILON) {
@@ -248,6 +253,11 @@ void UPGBase<Beta>::_traceLight(random_generator_t& generator, vector<LightVerte
     }
 
     itr->throughput /= bsdf.density;
+    itr->surface = _scene->querySurface(hit);
+
+    new_bsdf = _scene->sampleBSDF(generator, itr->surface, itr->omega);
+
+    auto edge = Edge(prv->surface, itr->surface, itr->omega);
 
     itr->bGeometry = edge.bGeometry;
     itr->length = prv->length + 1;
@@ -479,9 +489,9 @@ vec3 UPGBase<Beta>::_connect_light(const EyeVertex& eye, float Dp) {
 
 template <class Beta>
 vec3 UPGBase<Beta>::_connect_directional(const EyeVertex& eye, const LightSample& sample) {
-  auto isect = _scene->intersect(eye.surface, -sample.normal());
+  auto isect = _scene->castRay(eye.surface, -sample.normal());
 
-  if (isect.material_id == sample.surface.material_id) {
+  if (_scene->queryMaterial(isect) == sample.surface.material_id) {
     auto camera_bsdf = _scene->queryBSDF(eye.surface, -sample.normal(), eye.omega);
 
     float eye_vertex_merging = 0.f;
@@ -553,10 +563,20 @@ template <class Beta>
 vec3 UPGBase<Beta>::_connect(
   render_context_t& context,
   const EyeVertex& eye) {
-  size_t path = context.pixel_index;
+  const size_t num_paths = _light_offsets.size() - 1;
   vec3 radiance = vec3(0.0f);
 
+  if (num_paths == 0) {
+    return radiance;
+  }
+
+  // The number of light paths doesn't have to match the number of pixels.
+  // Every eye sample still connects to a single light path: the pixels
+  // spread their camera connections evenly over the paths and the other
+  // eye vertices pick a path from the whole pool.
   if (eye.surface.is_camera()) {
+    size_t path = context.pixel_index * num_paths / _eye_image.size();
+
     for (size_t index = _light_offsets[path], s = _light_offsets[path + 1]; index < s; ++index) {
       vec3 omega = normalize(_light_paths[index].surface.position() - eye.surface.position());
 
@@ -587,6 +607,8 @@ vec3 UPGBase<Beta>::_connect(
       }
     }
 
+    size_t path = min(size_t(context.generator->sample() * num_paths), num_paths - 1);
+
     for (size_t i = _light_offsets[path] + 1, s = _light_offsets[path + 1]; i < s; ++i) {
       radiance += _connect(_light_paths[i], eye);
     }
@@ -603,32 +625,31 @@ void UPGBase<Beta>::_scatter(random_generator_t& generator) {
 
   const size_t num_tasks = _threadpool.num_threads();
   const size_t num_photons = _num_photons / num_tasks;
-  const size_t num_photons_last = _num_photons - num_photons * (num_tasks - 1);
+  const size_t num_photons_first = _num_photons - num_photons * (num_tasks - 1);
 
-  const size_t prev_paths_size = _light_paths.size();
-  const size_t prev_offsets_size = _light_offsets.size();
+  _arenas.resize(num_tasks);
 
-  vector<vector<LightVertex>> paths(num_tasks - 1);
-  vector<vector<uint32_t>> offsets(num_tasks - 1);
+  auto trace = [this](random_generator_t& generator, scatter_arena_t& arena,
+                      size_t num_photons) {
+    size_t size = 0;
 
-  for (size_t i = 0; i < num_tasks - 1; ++i) {
-    paths.reserve(prev_paths_size / (num_tasks - 1));
-  }
+    arena.paths.clear();
+    arena.offsets.resize(num_photons);
 
-  for (size_t i = 0; i < num_tasks - 1; ++i) {
-    _threadpool.exec([=, &generator, &paths, &offsets, &mutex, &condition, &counter] {
-      auto local_generator = generator.clone();
-      size_t size = 0;
-
-      offsets[i].resize(1, 0);
-      offsets[i].reserve(num_photons + 1);
+    for (std::size_t j = 0; j < num_photons; ++j) {
+      _traceLight(generator, arena.paths, size);
+      arena.offsets[j] = uint32_t(size);
+    }
 
-      for (std::size_t j = 0; j < num_photons; ++j) {
-        _traceLight(local_generator, paths[i], size);
-        offsets[i].push_back(size);
-      }
+    arena.paths.resize(size);
+  };
 
-      paths[i].resize(size);
+  // The arena 0 is filled on this thread with the caller's generator, so
+  // its paths come first as before.
+  for (size_t i = 1; i < num_tasks; ++i) {
+    _threadpool.exec([=, &generator, &mutex, &condition, &counter] {
+      auto local_generator = generator.clone();
+      trace(local_generator, _arenas[i], num_photons);
 
       if (counter.fetch_add(1) == num_tasks - 2) {
         std::unique_lock<std::mutex> lock(mutex);
@@ -637,50 +658,161 @@ void UPGBase<Beta>::_scatter(random_generator_t& generator) {
     });
   }
 
-  size_t size = 0;
+  trace(generator, _arenas[0], num_photons_first);
 
-  _light_offsets.resize(1, 0);
-  _light_offsets.reserve(prev_offsets_size);
+  std::unique_lock<std::mutex> lock(mutex);
+  condition.wait(lock, [&] { return counter == num_tasks - 1; });
 
-  for (std::size_t i = 0; i < num_photons_last; ++i) {
-    _traceLight(generator, _light_paths, size);
-    _light_offsets.push_back(size);
-  }
+  // Every arena is published at the prefix sum of the preceding ones and
+  // copied by its own task.
+  vector<size_t> path_bases(num_tasks + 1, 0);
+  vector<size_t> offset_bases(num_tasks + 1, 0);
 
-  _light_paths.resize(size);
-  _light_paths.reserve(prev_paths_size);
+  for (size_t i = 0; i < num_tasks; ++i) {
+    path_bases[i + 1] = path_bases[i] + _arenas[i].paths.size();
+    offset_bases[i + 1] = offset_bases[i] + _arenas[i].offsets.size();
+  }
 
-  std::unique_lock<std::mutex> lock(mutex);
-  condition.wait(lock, [&] { return counter == num_tasks - 1; });
+  _light_paths.resize(path_bases[num_tasks]);
+  _light_offsets.resize(offset_bases[num_tasks] + 1);
+  _light_offsets[0] = 0;
 
-  for (size_t i = 0; i < paths.size(); ++i) {
-    _light_paths.insert(_light_paths.end(), paths[i].begin(), paths[i].end());
+  exec1d(_threadpool, num_tasks, 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      auto& arena = _arenas[i];
+      uint32_t base = uint32_t(path_bases[i]);
 
-    uint32_t offset = _light_offsets.back();
+      std::uninitialized_copy(arena.paths.begin(), arena.paths.end(),
+                              _light_paths.data() + path_bases[i]);
 
-    for (size_t j = 1; j < offsets[i].size(); ++j) {
-      _light_offsets.push_back(offsets[i][j] + offset);
+      for (size_t j = 0; j < arena.offsets.size(); ++j) {
+        _light_offsets[offset_bases[i] + j + 1] = arena.offsets[j] + base;
+      }
     }
-  }
+  });
 
   _num_scattered = _num_photons;
   _num_scattered_inv = 1.0f / float(_num_scattered);
+  _statistics.num_photons = _num_photons;
   _statistics.num_scattered += _num_scattered;
 
+  // The first pass replaces --radius with one derived from the density of
+  // its photons, the progressive shrinking applied so far is kept.
+  if (_auto_tune && !_radius_tuned) {
+    float radius = _estimate_radius();
+
+    if (radius > 0.0f) {
+      _radius *= radius / _initial_radius;
+      _circle = pi<float>() * _radius * _radius;
+      _initial_radius = radius;
+    }
+
+    _radius_tuned = true;
+  }
+
+  _statistics.radius = _radius;
+
   time_scope_t _(_statistics.build_time);
   _vertices = v3::HashGrid3D<LightVertex>(&_light_paths, _radius);
 }
 
+template <class Beta>
+void UPGBase<Beta>::set_statistics(const statistics_t& statistics) {
+  Technique::set_statistics(statistics);
+
+  _tuned_scatter_time = _statistics.scatter_time;
+  _tuned_gather_time = _statistics.gather_time;
+  _tuned_queries = _statistics.num_queries;
+  _tuned_merges = _statistics.num_merges;
+
+  if (!_auto_tune || _statistics.records.empty() ||
+      _statistics.records.back().num_photons == 0) {
+    return;
+  }
+
+  // The last frame's radius was shrunk from the tuned initial one at its
+  // sample index, see _preprocess.
+  auto& record = _statistics.records.back();
+  _num_photons = record.num_photons;
+  _initial_radius = _unbiased
+    ? record.radius
+    : record.radius / pow(float(record.sample_index) + 1.0f, _alpha * 0.5f - 0.5f);
+  _radius = record.radius;
+  _circle = pi<float>() * _radius * _radius;
+  _radius_tuned = true;
+}
+
+template <class Beta>
+void UPGBase<Beta>::_tune_photons() {
+  const size_t num_queries = _statistics.num_queries - _tuned_queries;
+  const size_t num_merges = _statistics.num_merges - _tuned_merges;
+
+  // The gather time is summed over the threads, the scatter pass runs on
+  // all of them.
+  double scatter_time = _statistics.scatter_time - _tuned_scatter_time;
+  double gather_time = (_statistics.gather_time - _tuned_gather_time)
+    / double(_threadpool.num_threads());
+
+  _tuned_scatter_time = _statistics.scatter_time;
+  _tuned_gather_time = _statistics.gather_time;
+  _tuned_queries = _statistics.num_queries;
+  _tuned_merges = _statistics.num_merges;
+
+  if (num_queries == 0) {
+    return;
+  }
+
+  // With a fixed radius both the merges per query and the scatter time
+  // grow linearly with the number of photons. Aim at the target merges,
+  // but don't let scattering take longer than gathering, and don't change
+  // the count by more than a factor of two per frame.
+  double merges_per_query = double(num_merges) / double(num_queries);
+  double scale = merges_per_query > 0.0
+    ? double(_target_merges) / merges_per_query
+    : 2.0;
+
+  if (scatter_time > 0.0 && gather_time > 0.0) {
+    scale = std::min(scale, gather_time / scatter_time);
+  }
+
+  scale = std::max(0.5, std::min(scale, 2.0));
+  _num_photons = std::max(size_t(double(_num_photons) * scale), size_t(_min_photons));
+}
+
+template <class Beta>
+float UPGBase<Beta>::_estimate_radius() const {
+  if (_light_paths.empty()) {
+    return 0.0f;
+  }
+
+  vec3 lower = _light_paths[0].position();
+  vec3 upper = lower;
+
+  for (auto&& vertex : _light_paths) {
+    lower = min(lower, vertex.position());
+    upper = max(upper, vertex.position());
+  }
+
+  // The photons are assumed to cover the faces of their bounding box
+  // evenly, a disc of the returned radius holds _target_merges of them.
+  vec3 extent = upper - lower;
+  float area = 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+
+  return sqrt(float(_target_merges) * area / (pi<float>() * float(_light_paths.size())));
+}
+
 template <class Beta>
 vec3 UPGBase<Beta>::_gather(
   render_context_t& context,
   const EyeVertex& eye,
   const EyeVertex& tentative) {
   vec3 radiance = vec3(0.0f);
+  size_t num_merges = 0;
 
   _vertices.rQuery(
     [&](uint32_t index) {
       time_scope_t _(_statistics.merge_time);
+      ++num_merges;
 
       runtime_assert(!_light_paths[index].surface.is_light());
 
@@ -694,6 +826,9 @@ vec3 UPGBase<Beta>::_gather(
     tentative.surface.position(),
     _radius);
 
+  ++context.num_queries;
+  context.num_merges += num_merges;
+
   return radiance;
 }
 
@@ -703,10 +838,12 @@ vec3 UPGBase<Beta>::_gather_biased(
   const EyeVertex& eye,
   const EyeVertex& tentative) {
   vec3 radiance = vec3(0.0f);
+  size_t num_merges = 0;
 
   _vertices.rQuery(
     [&](uint32_t index) {
       time_scope_t _(_statistics.merge_time);
+      ++num_merges;
 
       runtime_assert(!_light_paths[index].surface.is_light());
 
@@ -720,6 +857,9 @@ vec3 UPGBase<Beta>::_gather_biased(
     tentative.surface.position(),
     _radius);
 
+  ++context.num_queries;
+  context.num_merges += num_merges;
+
   return radiance;
 }
 
@@ -839,6 +979,7 @@ UPGb::UPGb(
   float lights,
   float roulette,
   size_t numPhotons,
+  bool auto_tune,
   float radius,
   float alpha,
   float beta,
@@ -852,6 +993,7 @@ UPGb::UPGb(
     lights,
     roulette,
     numPhotons,
+    auto_tune,
     radius,
     alpha,
     beta,
@@ -13,7 +13,10 @@ class UPGBase : public Technique, protected Beta {
 public:
   UPGBase(const shared<const Scene>& scene, bool unbiased, bool enable_vc,
     bool enable_vm, bool from_light, float lights, float roulette, size_t numPhotons,
-    float radius, float alpha, float beta, size_t numThreads);
+    bool auto_tune, float radius, float alpha, float beta, size_t numThreads);
+
+  // Also restores the tuned photon count and radius of a resumed render.
+  void set_statistics(const statistics_t& statistics) override;
 
 private:
   struct LightVertex {
@@ -53,6 +56,15 @@ private:
 
   static const size_t _maxSubpath = 1024;
   using light_path_t = fixed_vector<LightVertex, _maxSubpath>;
+  using light_paths_t = tracked_buffer_t<LightVertex, memory_tag_t::light_paths>;
+  using light_offsets_t = tracked_buffer_t<uint32_t, memory_tag_t::light_offsets>;
+
+  // Paths traced by one scatter task, kept between frames for the capacity.
+  // The offsets are the ends of the task's paths.
+  struct scatter_arena_t {
+    light_paths_t paths;
+    light_offsets_t offsets;
+  };
 
   vec3 _traceEye(render_context_t& context, Ray ray) override;
   void _preprocess(random_generator_t& generator, double num_samples) override;
@@ -60,7 +72,7 @@ private:
   LightVertex _sample_to_vertex(const LightSample& sample);
   LightVertex _sample_light(random_generator_t& generator);
 
-  void _traceLight(random_generator_t& generator, vector<LightVertex>& path,
+  void _traceLight(random_generator_t& generator, light_paths_t& path,
     size_t& size);
 
   float _vc_subweight_inv(const Connection& connection);
@@ -92,6 +104,8 @@ private:
   vec3 _connect(render_context_t& context, const EyeVertex& eye);
 
   void _scatter(random_generator_t& generator);
+  void _tune_photons();
+  float _estimate_radius() const;
 
   vec3 _gather(render_context_t& context, const EyeVertex& eye,
     const EyeVertex& tentative);
@@ -116,7 +130,13 @@ private:
   static const int _trim_light = _merge_from_light ? 1 : 0;
   static const int _trim_eye = _merge_from_light ? 1 : 0;
 
-  const size_t _num_photons;
+  // The auto-tuning aims at this many merges per gather query and doesn't
+  // go below _min_photons.
+  static const size_t _target_merges = 16;
+  static const size_t _min_photons = 1024;
+
+  size_t _num_photons;
+  const bool _auto_tune;
   const bool _unbiased;
   const bool _enable_vc;
   const bool _enable_vm;
@@ -124,7 +144,7 @@ private:
   const float _lights;
   const float _roulette;
   const float _roulette_inv;
-  const float _initial_radius;
+  float _initial_radius;
   const float _alpha;
   const float _clamp_const;
 
@@ -133,8 +153,15 @@ private:
   float _radius;
   float _circle;
 
-  vector<LightVertex> _light_paths;
-  vector<uint32_t> _light_offsets;
+  bool _radius_tuned = false;
+  double _tuned_scatter_time = 0.0;
+  double _tuned_gather_time = 0.0;
+  size_t _tuned_queries = 0;
+  size_t _tuned_merges = 0;
+
+  light_paths_t _light_paths;
+  light_offsets_t _light_offsets;
+  vector<scatter_arena_t> _arenas;
   v3::HashGrid3D<LightVertex> _vertices;
 };
 
@@ -146,7 +173,7 @@ class UPGb : public UPGBase<VariableBeta> {
 public:
   UPGb(const shared<const Scene>& scene, bool unbiased, bool enable_vc,
     bool enable_vm, bool from_light, float lights, float roulette,
-    size_t numPhotons, float radius, float alpha, float beta,
+    size_t numPhotons, bool auto_tune, float radius, float alpha, float beta,
     size_t numThreads);
 };
 
@@ -165,6 +165,18 @@ void UserInterface::_updateStatistics(
         float mainElapsed = float(high_resolution_time() - mainStart);
         ImGui::InputFloat("real time [s] ", &mainElapsed);
     }
+
+    if(ImGui::CollapsingHeader("Memory statistics")) {
+        for (size_t i = 0; i < size_t(memory_tag_t::count); ++i) {
+            auto usage = memory_usage(memory_tag_t(i));
+
+            ImGui::Text(
+                "%-14s %8.1f / %8.1f MiB",
+                to_string(memory_tag_t(i)),
+                double(usage.live) / (1024.0 * 1024.0),
+                double(usage.peak) / (1024.0 * 1024.0));
+        }
+    }
 }
 
 }
@@ -379,7 +379,29 @@ template <class T> void runQueries(
     }
 }
 
-template <template <class> class T> void run_test_case(string name, ifstream& stream) {
+template <class T> void runQueriesBatched(
+    const T& points,
+    const vector<TestStruct>& data,
+    const vector<vec3>& queries,
+    vector<vector<TestStruct>>& result,
+    float radius)
+{
+    vector<size_t> sizes(queries.size(), 0);
+
+    points.rQueryBatch(
+        [&](size_t query, uint32_t index) {
+            result[query][sizes[query]++] = data[index];
+        },
+        queries.data(),
+        queries.size(),
+        radius);
+
+    for (size_t i = 0; i < queries.size(); ++i) {
+        result[i].resize(sizes[i]);
+    }
+}
+
+template <template <class> class T, class Run> void run_test_case(string name, ifstream& stream, Run run) {
     vector<vec3> data, queries;
     vector<vector<vec3>> result;
     float radius = 0.0f;
@@ -402,7 +424,7 @@ template <template <class> class T> void run_test_case(string name, ifstream& st
     auto build = chrono::high_resolution_clock::now();
 
     // BENCHMARKED CALL
-    runQueries(accel_struct, queries, testResult, radius);
+    run(accel_struct, testData, queries, testResult, radius);
 
     auto end = chrono::high_resolution_clock::now();
 
@@ -461,6 +483,18 @@ template <template <class> class T> void run_test_case(string name, ifstream& st
     // cout << "SUCCESS" << endl;
 }
 
+template <template <class> class T> void run_test_case(string name, ifstream& stream) {
+    run_test_case<T>(name, stream, [](auto& points, auto&, auto& queries, auto& result, float radius) {
+        runQueries(points, queries, result, radius);
+    });
+}
+
+template <template <class> class T> void run_batched_test_case(string name, ifstream& stream) {
+    run_test_case<T>(name, stream, [](auto& points, auto& data, auto& queries, auto& result, float radius) {
+        runQueriesBatched(points, data, queries, result, radius);
+    });
+}
+
 template <template <class> class T> void run_test_case(string path) {
     ifstream stream(path, ifstream::binary);
     run_test_case<T>("<current>", stream);
@@ -477,6 +511,8 @@ void run_comparison(string path) {
     run_test_case<v2::HashGrid3D>("v2::HashGrid3D", stream2);*/
     ifstream stream3(path, ifstream::binary);
     run_test_case<v3::HashGrid3D>("v3::HashGrid3D", stream3);
+    ifstream stream4(path, ifstream::binary);
+    run_batched_test_case<v3::HashGrid3D>("v3 batched", stream4);
 }
 
 void test_case_header() {
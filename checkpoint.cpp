@@ -0,0 +1,250 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <unittest>
+#include <checkpoint.hpp>
+#include <system_utils.hpp>
+
+namespace haste {
+
+static const char checkpoint_magic[8] = { 'H', 'C', 'H', 'K', 'P', 'T', '\0', '\5' };
+
+string checkpoint_path(const string& image_path) {
+  return image_path + ".checkpoint";
+}
+
+// Records and measurements are written field by field, so the format
+// doesn't depend on the struct layout. Floats are widened to doubles.
+static void write_record(binary_writer_t& writer, const statistics_t::record_t& record) {
+  writer.write(uint64_t(record.sample_index));
+  writer.write(double(record.rms_error));
+  writer.write(double(record.abs_error));
+  writer.write(double(record.clock_time));
+  writer.write(double(record.frame_duration));
+  writer.write(uint64_t(record.numeric_errors));
+  writer.write(uint64_t(record.num_photons));
+  writer.write(double(record.radius));
+}
+
+static void read_record(binary_reader_t& reader, statistics_t::record_t& record) {
+  record.sample_index = size_t(reader.read_u64());
+  record.rms_error = float(reader.read_f64());
+  record.abs_error = float(reader.read_f64());
+  record.clock_time = float(reader.read_f64());
+  record.frame_duration = float(reader.read_f64());
+  record.numeric_errors = size_t(reader.read_u64());
+  record.num_photons = size_t(reader.read_u64());
+  record.radius = float(reader.read_f64());
+}
+
+static void write_measurement(binary_writer_t& writer, const statistics_t::measurement_t& measurement) {
+  writer.write(uint64_t(measurement.sample_index));
+  writer.write(uint64_t(int64_t(measurement.pixel_x)));
+  writer.write(uint64_t(int64_t(measurement.pixel_y)));
+  writer.write(double(measurement.rms_error));
+  writer.write(double(measurement.abs_error));
+  writer.write(double(measurement.value.x));
+  writer.write(double(measurement.value.y));
+  writer.write(double(measurement.value.z));
+}
+
+static void read_measurement(binary_reader_t& reader, statistics_t::measurement_t& measurement) {
+  measurement.sample_index = size_t(reader.read_u64());
+  measurement.pixel_x = int(int64_t(reader.read_u64()));
+  measurement.pixel_y = int(int64_t(reader.read_u64()));
+  measurement.rms_error = float(reader.read_f64());
+  measurement.abs_error = float(reader.read_f64());
+  measurement.value.x = float(reader.read_f64());
+  measurement.value.y = float(reader.read_f64());
+  measurement.value.z = float(reader.read_f64());
+}
+
+void save_checkpoint(
+  const string& path,
+  const Options& options,
+  const statistics_t& statistics,
+  const string& generator_state,
+  const dvec4* data) {
+  auto metadata = statistics.to_dict(false);
+  auto local_options = options.to_dict();
+  metadata.insert(local_options.begin(), local_options.end());
+
+  string temp = path + ".tmp";
+  FILE* file = fopen(temp.c_str(), "wb");
+
+  if (file == nullptr) {
+    throw std::runtime_error("failed to open " + temp);
+  }
+
+  try {
+    binary_writer_t writer = { file };
+    writer.write(checkpoint_magic, sizeof(checkpoint_magic));
+    writer.write(uint64_t(options.width));
+    writer.write(uint64_t(options.height));
+
+    writer.write(uint64_t(metadata.size()));
+
+    for (auto&& entry : metadata) {
+      writer.write(entry.first);
+      writer.write(entry.second);
+    }
+
+    writer.write(generator_state);
+
+    writer.write(uint64_t(statistics.num_samples));
+    writer.write(uint64_t(statistics.num_basic_rays));
+    writer.write(uint64_t(statistics.num_shadow_rays));
+    writer.write(uint64_t(statistics.num_tentative_rays));
+    writer.write(uint64_t(statistics.num_photons));
+    writer.write(uint64_t(statistics.num_scattered));
+    writer.write(statistics.total_time);
+    writer.write(statistics.scatter_time);
+    writer.write(statistics.build_time);
+    writer.write(statistics.gather_time);
+    writer.write(statistics.merge_time);
+    writer.write(statistics.density_time);
+    writer.write(statistics.intersect_time);
+    writer.write(statistics.trace_eye_time);
+    writer.write(statistics.trace_light_time);
+    writer.write(statistics.accel_build_time);
+    writer.write(uint64_t(statistics.num_queries));
+    writer.write(uint64_t(statistics.num_merges));
+    writer.write(statistics.radius);
+
+    writer.write(uint64_t(statistics.records.size()));
+
+    for (auto&& record : statistics.records) {
+      write_record(writer, record);
+    }
+
+    writer.write(uint64_t(statistics.measurements.size()));
+
+    for (auto&& measurement : statistics.measurements) {
+      write_measurement(writer, measurement);
+    }
+
+    writer.write(data, options.width * options.height * sizeof(dvec4));
+  }
+  catch (...) {
+    fclose(file);
+    std::remove(temp.c_str());
+    throw;
+  }
+
+  if (fclose(file) != 0) {
+    throw std::runtime_error("failed to write checkpoint");
+  }
+
+  move_file(temp, path);
+}
+
+void load_checkpoint(const string& path, checkpoint_t& checkpoint, bool with_data) {
+  mapped_file_t file(path);
+  binary_reader_t reader = { file.data(), file.data() + file.size() };
+
+  char magic[sizeof(checkpoint_magic)];
+  reader.read(magic, sizeof(magic));
+
+  if (std::memcmp(magic, checkpoint_magic, sizeof(magic)) != 0) {
+    throw std::runtime_error("invalid checkpoint " + path);
+  }
+
+  checkpoint.width = size_t(reader.read_u64());
+  checkpoint.height = size_t(reader.read_u64());
+
+  size_t num_entries = size_t(reader.read_u64());
+  checkpoint.metadata.clear();
+
+  for (size_t i = 0; i < num_entries; ++i) {
+    string key = reader.read_string();
+    checkpoint.metadata[key] = reader.read_string();
+  }
+
+  checkpoint.generator_state = reader.read_string();
+
+  auto& statistics = checkpoint.statistics;
+  statistics.num_samples = size_t(reader.read_u64());
+  statistics.num_basic_rays = size_t(reader.read_u64());
+  statistics.num_shadow_rays = size_t(reader.read_u64());
+  statistics.num_tentative_rays = size_t(reader.read_u64());
+  statistics.num_photons = size_t(reader.read_u64());
+  statistics.num_scattered = size_t(reader.read_u64());
+  statistics.total_time = reader.read_f64();
+  statistics.scatter_time = reader.read_f64();
+  statistics.build_time = reader.read_f64();
+  statistics.gather_time = reader.read_f64();
+  statistics.merge_time = reader.read_f64();
+  statistics.density_time = reader.read_f64();
+  statistics.intersect_time = reader.read_f64();
+  statistics.trace_eye_time = reader.read_f64();
+  statistics.trace_light_time = reader.read_f64();
+  statistics.accel_build_time = reader.read_f64();
+  statistics.num_queries = size_t(reader.read_u64());
+  statistics.num_merges = size_t(reader.read_u64());
+  statistics.radius = reader.read_f64();
+
+  statistics.records.resize(size_t(reader.read_u64()));
+
+  for (auto&& record : statistics.records) {
+    read_record(reader, record);
+  }
+
+  statistics.measurements.resize(size_t(reader.read_u64()));
+
+  for (auto&& measurement : statistics.measurements) {
+    read_measurement(reader, measurement);
+  }
+
+  if (with_data) {
+    checkpoint.data.resize(checkpoint.width * checkpoint.height);
+    reader.read(checkpoint.data.data(), checkpoint.data.size() * sizeof(dvec4));
+  }
+}
+
+unittest() {
+  Options options;
+  options.width = 2;
+  options.height = 1;
+
+  statistics_t statistics;
+  statistics.num_samples = 7;
+  statistics.total_time = 1.0 / 3.0;
+  statistics.records.resize(1);
+  statistics.records[0].sample_index = 6;
+  statistics.records[0].frame_duration = 0.1f;
+  statistics.measurements.resize(1);
+  statistics.measurements[0].pixel_x = -1;
+  statistics.measurements[0].value = vec3(1.0f, 2.0f, 3.0f);
+
+  random_generator_t generator(42);
+  generator();
+
+  dvec4 data[2] = { dvec4(1.0 / 3.0, 0.1, 0.2, 7.0), dvec4(1e-17, 2.0, 3.0, 7.0) };
+
+  string path = temppath(".checkpoint");
+  save_checkpoint(path, options, statistics, generator.state(), data);
+
+  checkpoint_t checkpoint;
+  load_checkpoint(path, checkpoint);
+  std::remove(path.c_str());
+
+  random_generator_t restored;
+  restored.set_state(checkpoint.generator_state);
+
+  assert_true(checkpoint.width == 2 && checkpoint.height == 1);
+  assert_true(checkpoint.data[0] == data[0]);
+  assert_true(checkpoint.data[1] == data[1]);
+  assert_true(checkpoint.statistics.num_samples == 7);
+  assert_true(checkpoint.statistics.total_time == statistics.total_time);
+  assert_true(checkpoint.statistics.records.size() == 1);
+  assert_true(checkpoint.statistics.records[0].sample_index == 6);
+  assert_true(checkpoint.statistics.records[0].frame_duration == 0.1f);
+  assert_true(checkpoint.statistics.measurements.size() == 1);
+  assert_true(checkpoint.statistics.measurements[0].pixel_x == -1);
+  assert_true(checkpoint.statistics.measurements[0].value == vec3(1.0f, 2.0f, 3.0f));
+  assert_true(checkpoint.metadata["options.width"] == "2");
+  assert_true(restored() == generator());
+}
+
+}
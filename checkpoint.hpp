@@ -0,0 +1,34 @@
+#pragma once
+#include <Options.hpp>
+#include <Sample.hpp>
+
+namespace haste {
+
+// Everything needed to resume a render: the raw dvec4 accumulator, the
+// state of the main random generator, the statistics and the options (which
+// carry the technique parameters). Unlike the EXR the checkpoint keeps the
+// accumulator in double precision. Single-threaded renders resume
+// bit-exactly. Parallel ones draw the same random numbers, as the tile
+// generators are seeded from the main one, but the order in which threads
+// add to the light image can change the last bits.
+struct checkpoint_t {
+  size_t width = 0;
+  size_t height = 0;
+  vector<dvec4> data;
+  string generator_state;
+  map<string, string> metadata;
+  statistics_t statistics;
+};
+
+string checkpoint_path(const string& image_path);
+
+void save_checkpoint(
+  const string& path,
+  const Options& options,
+  const statistics_t& statistics,
+  const string& generator_state,
+  const dvec4* data);
+
+void load_checkpoint(const string& path, checkpoint_t& checkpoint, bool with_data = true);
+
+}
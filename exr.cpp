@@ -12,6 +12,7 @@
 #include <ImfInputFile.h>
 #include <ImfOutputFile.h>
 #include <ImfStringAttribute.h>
+#include <ImfThreading.h>
 #include <ImfVecAttribute.h>
 
 namespace haste {
@@ -19,12 +20,32 @@ namespace haste {
 using namespace std;
 using namespace Imf;
 
-void save_exr(
+void set_exr_threads(size_t num_threads) {
+  runtime_assert(num_threads < INT_MAX);
+  setGlobalThreadCount(int(num_threads));
+}
+
+static Compression exr_compression(exr_compression_t compression) {
+  switch (compression) {
+    case exr_compression_t::none: return NO_COMPRESSION;
+    case exr_compression_t::piz: return PIZ_COMPRESSION;
+    case exr_compression_t::dwaa: return DWAA_COMPRESSION;
+    default: return ZIP_COMPRESSION;
+  }
+}
+
+// The images are stored bottom-up in memory, the slices start at the last
+// row and walk backwards (negative y stride), so no flipped copy is needed.
+template <class T>
+static void save_exr(
   const string& path,
   const map<string, string>& metadata,
   size_t width,
   size_t height,
-  const vec3* data)
+  const T* data,
+  const exr_format_t& format,
+  const char* const* channels,
+  size_t num_channels)
 {
   runtime_assert(width < INT_MAX);
   runtime_assert(height < INT_MAX);
@@ -33,9 +54,13 @@ void save_exr(
   int iheight = int(height);
 
   Header header(iwidth, iheight);
-  header.channels().insert("R", Channel(Imf::FLOAT));
-  header.channels().insert("G", Channel(Imf::FLOAT));
-  header.channels().insert("B", Channel(Imf::FLOAT));
+  header.compression() = exr_compression(format.compression);
+
+  for (size_t i = 0; i < num_channels; ++i) {
+    // The denominator is a sample count, it does not fit in half.
+    bool half = format.half && std::strcmp(channels[i], "denom") != 0;
+    header.channels().insert(channels[i], Channel(half ? Imf::HALF : Imf::FLOAT));
+  }
 
   for (auto&& entry : metadata) {
     header.insert(entry.first, StringAttribute(entry.second));
@@ -45,28 +70,16 @@ void save_exr(
 
   FrameBuffer framebuffer;
 
-  size_t size = width * height * 3;
-  vector<float> data_copy(size);
+  if (width != 0 && height != 0) {
+    const float* last_row = (const float*)(data + (height - 1) * width);
+    size_t y_stride = size_t(-ptrdiff_t(sizeof(T) * width));
 
-  for (size_t y = 0; y < height; ++y) {
-    for (size_t x = 0; x < width; ++x) {
-      data_copy[(y * width + x) * 3 + 0] = data[(height - y - 1) * width + x].x;
-      data_copy[(y * width + x) * 3 + 1] = data[(height - y - 1) * width + x].y;
-      data_copy[(y * width + x) * 3 + 2] = data[(height - y - 1) * width + x].z;
+    for (size_t i = 0; i < num_channels; ++i) {
+      auto slice = Slice(Imf::FLOAT, (char*)(last_row + i), sizeof(T), y_stride);
+      framebuffer.insert(channels[i], slice);
     }
   }
 
-  auto R = Slice(Imf::FLOAT, (char*)(data_copy.data() + 0), sizeof(float) * 3,
-                 sizeof(float) * width * 3);
-  auto G = Slice(Imf::FLOAT, (char*)(data_copy.data() + 1), sizeof(float) * 3,
-                 sizeof(float) * width * 3);
-  auto B = Slice(Imf::FLOAT, (char*)(data_copy.data() + 2), sizeof(float) * 3,
-                 sizeof(float) * width * 3);
-
-  framebuffer.insert("R", R);
-  framebuffer.insert("G", G);
-  framebuffer.insert("B", B);
-
   file.setFrameBuffer(framebuffer);
   file.writePixels(iheight);
 }
@@ -76,10 +89,23 @@ void save_exr(
   const map<string, string>& metadata,
   size_t width,
   size_t height,
-  const vector<vec3>& data)
+  const vec3* data,
+  const exr_format_t& format)
+{
+  static const char* const channels[] = { "R", "G", "B" };
+  save_exr(path, metadata, width, height, data, format, channels, 3);
+}
+
+void save_exr(
+  const string& path,
+  const map<string, string>& metadata,
+  size_t width,
+  size_t height,
+  const vector<vec3>& data,
+  const exr_format_t& format)
 {
   runtime_assert(data.size() == width * height);
-  save_exr(path, metadata, width, height, data.data());
+  save_exr(path, metadata, width, height, data.data(), format);
 }
 
 void load_metadata(const InputFile& file, map<string, string>& metadata) {
@@ -179,56 +205,28 @@ void save_exr(
   const map<string, string>& metadata,
   size_t width,
   size_t height,
-  const vec4* data)
+  const vec4* data,
+  const exr_format_t& format)
 {
-  runtime_assert(width < INT_MAX);
-  runtime_assert(height < INT_MAX);
-
-  int iwidth = int(width);
-  int iheight = int(height);
+  static const char* const channels[] = { "R", "G", "B", "denom" };
 
-  Header header(iwidth, iheight);
-  header.channels().insert("R", Channel(Imf::FLOAT));
-  header.channels().insert("G", Channel(Imf::FLOAT));
-  header.channels().insert("B", Channel(Imf::FLOAT));
-  header.channels().insert("denom", Channel(Imf::FLOAT));
-
-  for (auto&& entry : metadata) {
-    header.insert(entry.first, StringAttribute(entry.second));
+  if (!format.half) {
+    save_exr(path, metadata, width, height, data, format, channels, 4);
+    return;
   }
 
-  OutputFile file(path.c_str(), header);
-
-  FrameBuffer framebuffer;
-
-  size_t size = width * height * 4;
-  vector<float> data_copy(size);
+  // The accumulated sums overflow half after a few thousand samples, the
+  // colors are normalized first and stored with a unit denominator. Such
+  // an image can't be continued or merged, only its checkpoint can.
+  vector<vec4> normalized(data, data + width * height);
 
-  for (size_t y = 0; y < height; ++y) {
-    for (size_t x = 0; x < width; ++x) {
-      data_copy[(y * width + x) * 4 + 0] = data[(height - y - 1) * width + x].x;
-      data_copy[(y * width + x) * 4 + 1] = data[(height - y - 1) * width + x].y;
-      data_copy[(y * width + x) * 4 + 2] = data[(height - y - 1) * width + x].z;
-      data_copy[(y * width + x) * 4 + 3] = data[(height - y - 1) * width + x].w;
+  for (auto& pixel : normalized) {
+    if (pixel.w != 0.0f) {
+      pixel = vec4(pixel.xyz() / pixel.w, 1.0f);
     }
   }
 
-  auto R = Slice(Imf::FLOAT, (char*)(data_copy.data() + 0), sizeof(float) * 4,
-                 sizeof(float) * width * 4);
-  auto G = Slice(Imf::FLOAT, (char*)(data_copy.data() + 1), sizeof(float) * 4,
-                 sizeof(float) * width * 4);
-  auto B = Slice(Imf::FLOAT, (char*)(data_copy.data() + 2), sizeof(float) * 4,
-                 sizeof(float) * width * 4);
-  auto D = Slice(Imf::FLOAT, (char*)(data_copy.data() + 3), sizeof(float) * 4,
-                 sizeof(float) * width * 4);
-
-  framebuffer.insert("R", R);
-  framebuffer.insert("G", G);
-  framebuffer.insert("B", B);
-  framebuffer.insert("denom", D);
-
-  file.setFrameBuffer(framebuffer);
-  file.writePixels(iheight);
+  save_exr(path, metadata, width, height, normalized.data(), format, channels, 4);
 }
 
 void save_exr(
@@ -236,10 +234,11 @@ void save_exr(
   const map<string, string>& metadata,
   size_t width,
   size_t height,
-  const vector<vec4>& data)
+  const vector<vec4>& data,
+  const exr_format_t& format)
 {
   runtime_assert(data.size() == width * height);
-  save_exr(path, metadata, width, height, data.data());
+  save_exr(path, metadata, width, height, data.data(), format);
 }
 
 void load_exr(
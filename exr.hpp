@@ -11,19 +11,30 @@ using std::size_t;
 using std::string;
 using std::vector;
 
+enum class exr_compression_t { none, zip, piz, dwaa };
+
+struct exr_format_t {
+  exr_compression_t compression = exr_compression_t::zip;
+  bool half = false;
+};
+
+void set_exr_threads(size_t num_threads);
+
 void save_exr(
   const string& path,
   const map<string, string>& metadata,
   size_t width,
   size_t height,
-  const vec3* data);
+  const vec3* data,
+  const exr_format_t& format = exr_format_t());
 
 void save_exr(
   const string& path,
   const map<string, string>& metadata,
   size_t width,
   size_t height,
-  const vector<vec3>& data);
+  const vector<vec3>& data,
+  const exr_format_t& format = exr_format_t());
 
 void load_exr(
   const string& path,
@@ -41,14 +52,16 @@ void save_exr(
   const map<string, string>& metadata,
   size_t width,
   size_t height,
-  const vec4* data);
+  const vec4* data,
+  const exr_format_t& format = exr_format_t());
 
 void save_exr(
   const string& path,
   const map<string, string>& metadata,
   size_t width,
   size_t height,
-  const vector<vec4>& data);
+  const vector<vec4>& data,
+  const exr_format_t& format = exr_format_t());
 
 void load_exr(
   const string& path,
@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <farm.hpp>
+#include <system_utils.hpp>
+#include <threadpool.hpp>
+#include <utility.hpp>
+
+namespace haste {
+
+// mt19937 keeps 32 bits of the seed, the main generator of a worker is
+// reseeded with seed + num_samples on every frame when seeding is enabled.
+// The stride leaves every worker 2^24 samples before the seeds overlap.
+static const size_t farm_seed_stride = size_t(1) << 24;
+static const size_t farm_default_interval = 60;
+
+struct worker_t {
+  string output;
+  intptr_t process = 0;
+  bool running = false;
+  size_t mtime = 0;
+  bool loaded = false;
+  partial_t partial;
+};
+
+static vector<string> worker_args(
+  const Options& options,
+  int argc,
+  char const* const* argv,
+  size_t index,
+  const string& output,
+  size_t interval) {
+  static const char* const overridden[] = {
+    "--workers", "--output", "--seed", "--num-samples", "--snapshot",
+    "--batch", "--interactive", "--fast", "--checkpoint", "--quiet",
+    "--parallel", "--threads"
+  };
+
+  vector<string> result = { argv[0] };
+
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    string key = arg.substr(0, arg.find('='));
+    bool skip = false;
+
+    for (auto&& prefix : overridden) {
+      skip = skip || key == prefix;
+    }
+
+    if (!skip) {
+      result.push_back(arg);
+    }
+  }
+
+  result.push_back("--output=" + output);
+
+  // Only BPT, VCM and UPG take a seed, the other workers rely on
+  // random_device.
+  if (options.technique == Options::BPT ||
+      options.technique == Options::VCM ||
+      options.technique == Options::UPG) {
+    result.push_back("--seed=" + std::to_string(options.seed + index * farm_seed_stride));
+  }
+
+  // The workers share the cores the coordinator was given.
+  if (options.num_threads != 1) {
+    size_t num_threads = options.num_threads == 0 ? default_num_cores() : options.num_threads;
+    result.push_back("--threads=" + std::to_string(std::max<size_t>(num_threads / options.num_workers, 1)));
+  }
+
+  result.push_back("--snapshot=" + std::to_string(interval));
+  result.push_back("--batch");
+  result.push_back("--checkpoint");
+  result.push_back("--quiet");
+
+  if (options.num_samples != 0) {
+    size_t share = options.num_samples / options.num_workers;
+    size_t extra = index < options.num_samples % options.num_workers ? 1 : 0;
+    result.push_back("--num-samples=" + std::to_string(std::max<size_t>(share + extra, 1)));
+  }
+
+  return result;
+}
+
+// Reloads the partial results which changed since the last merge and
+// writes their sum as the combined output.
+static void merge_workers(const Options& options, vector<worker_t>& workers) {
+  vector<const partial_t*> partials;
+
+  for (auto&& worker : workers) {
+    if (isfile(worker.output)) {
+      size_t mtime = getmtime(worker.output);
+
+      if (!worker.loaded || mtime != worker.mtime) {
+        try {
+          load_partial(worker.output, worker.partial);
+          worker.mtime = mtime;
+          worker.loaded = true;
+        }
+        catch (const std::exception& error) {
+          std::cerr << "Failed to load `" << worker.output << "`: " << error.what() << std::endl;
+        }
+      }
+    }
+
+    if (worker.loaded) {
+      partials.push_back(&worker.partial);
+    }
+  }
+
+  if (partials.empty()) {
+    return;
+  }
+
+  Options merged_options;
+  statistics_t statistics;
+  vector<dvec4> data;
+
+  merge_partials(merged_options, statistics, data, partials);
+
+  merged_options.output = options.get_output();
+  merged_options.num_samples = options.num_samples;
+  merged_options.num_seconds = options.num_seconds;
+  merged_options.checkpoint = false;
+
+  save_exr(merged_options, statistics, data.data());
+
+  if (!options.quiet) {
+    std::cout << "Merged " << partials.size() << " partial results into `"
+              << merged_options.output << "` (" << statistics.num_samples
+              << " samples)." << std::endl;
+  }
+}
+
+int run_farm(const Options& options, int argc, char const* const* argv) {
+  size_t interval = options.snapshot != 0 ? options.snapshot : farm_default_interval;
+  string output = options.get_output();
+
+  vector<worker_t> workers(options.num_workers);
+
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i].output = output + ".worker" + std::to_string(i) + ".exr";
+    workers[i].process = spawn_process(worker_args(options, argc, argv, i, workers[i].output, interval));
+    workers[i].running = true;
+  }
+
+  int result = 0;
+  size_t num_running = workers.size();
+  double last_merge = high_resolution_time();
+
+  while (num_running != 0) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    for (size_t i = 0; i < workers.size(); ++i) {
+      int exit_code = 0;
+
+      if (workers[i].running && poll_process(workers[i].process, exit_code)) {
+        workers[i].running = false;
+        --num_running;
+
+        // The last snapshot of a crashed worker is still merged, only the
+        // work done after it is lost.
+        if (exit_code != 0) {
+          std::cerr << "Worker " << i << " failed with code " << exit_code << "." << std::endl;
+          result = 1;
+        }
+
+        if (!isfile(workers[i].output)) {
+          std::cerr << "Worker " << i << " exited before writing a snapshot." << std::endl;
+          result = 1;
+        }
+      }
+    }
+
+    if (high_resolution_time() - last_merge >= double(interval)) {
+      merge_workers(options, workers);
+      last_merge = high_resolution_time();
+    }
+  }
+
+  merge_workers(options, workers);
+  return result;
+}
+
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <Options.hpp>
+
+namespace haste {
+
+// Renders the scene with options.num_workers worker processes (the same
+// executable in batch mode) and merges their partial results into the
+// output every options.snapshot seconds.
+int run_farm(const Options& options, int argc, char const* const* argv);
+
+}
@@ -14,6 +14,7 @@
 #include <iterator>
 #include <utility>
 #include <type_traits>
+#include <xmmintrin.h>
 
 #ifdef _MSC_VER
 #define SKA_NOINLINE(...) __declspec(noinline) __VA_ARGS__
@@ -774,6 +775,11 @@ public:
     {
         return hash_policy.index_for_hash(hash_object(key), num_slots_minus_one);
     }
+    // haste: starts loading the slot a later find(key) probes first.
+    void prefetch(const FindKey & key) const
+    {
+        _mm_prefetch(reinterpret_cast<const char *>(entries + ptrdiff_t(bucket(key))), _MM_HINT_T0);
+    }
     float load_factor() const
     {
         size_t buckets = bucket_count();
@@ -7,6 +7,7 @@
 #include <imgui.h>
 #include <imgui_impl_glfw_gl3.h>
 #include <framework.hpp>
+#include <memory.hpp>
 #include <utility.hpp>
 
 #include <mutex>
@@ -342,11 +343,15 @@ void Framework::postproc(glm::vec4* dst, const glm::vec3* src, size_t width, siz
     }
 }
 
+using framebuffer_t =
+    haste::tracked_vector<glm::dvec4, haste::memory_tag_t::framebuffer>;
+
 int Framework::run(size_t width, size_t height, const std::string& caption) {
     return ::run(width, height, caption, [=](GLFWwindow* window) {
+        haste::process_startup_report().mark("glfw");
         _window = window;
 
-        std::vector<glm::dvec4> buffer;
+        framebuffer_t buffer;
         std::atomic<int> bufferWidth, bufferHeight;
         std::atomic<bool> trigger, done, quit;
         std::atomic<double> elapsed;
@@ -424,7 +429,7 @@ int Framework::run(size_t width, size_t height, const std::string& caption) {
 }
 
 int Framework::runBatch(size_t width, size_t height) {
-    std::vector<glm::dvec4> buffer;
+    framebuffer_t buffer;
     buffer.resize(width * height);
     std::memset(buffer.data(), 0, buffer.size() * sizeof(glm::vec4));
 
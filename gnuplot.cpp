@@ -18,11 +18,6 @@ struct ivec2_less {
     };
 };
 
-statistics_t load_statistics(string path) {
-  map<string, string> metadata = load_metadata(path);
-  return statistics_t(metadata);
-}
-
 std::string exec(string cmd) {
   std::array<char, 128> buffer;
   std::string result;
@@ -3,8 +3,14 @@
 #include <assimp/Importer.hpp>
 #include <runtime_assert>
 #include <streamops.hpp>
+#include <unittest>
 
+#include <cstdio>
+#include <cstring>
+#include <random>
 #include <loader.hpp>
+#include <system_utils.hpp>
+#include <threadpool.hpp>
 #include <utility.hpp>
 
 #include <BSDF.hpp>
@@ -132,6 +138,33 @@ vec3 toVec3(const aiVector3D& v) { return vec3(v.x, v.y, v.z); }
 
 vec3 toVec3(const aiColor3D& v) { return vec3(v.r, v.g, v.b); }
 
+mat4 toMat4(const aiMatrix4x4& m) {
+  mat4 result;
+
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      result[j][i] = m[i][j];
+    }
+  }
+
+  return result;
+}
+
+// Transformation from the space of the node to the world space.
+mat4 world_transform(const aiNode* node) {
+  mat4 result = mat4(1.0f);
+
+  for (; node != nullptr; node = node->mParent) {
+    result = toMat4(node->mTransformation) * result;
+  }
+
+  return result;
+}
+
+mat4 world_transform(const aiScene* scene, const aiString& name) {
+  return world_transform(scene->mRootNode->FindNode(name));
+}
+
 string name(const aiMaterial* material) {
   aiString name;
   material->Get(AI_MATKEY_NAME, name);
@@ -290,77 +323,339 @@ bool isEmissive(const aiScene* scene, size_t meshID) {
   return emissive(material) != vec3(0.0f);
 }
 
-void load_cameras(const aiScene* scene, Materials& materials,
-                  Cameras& cameras) {
+// Everything the Scene is built from, extracted from the Assimp scene. It
+// is plain data, so it can be written to the scene cache and read back
+// without running Assimp.
+struct camera_source_t {
+  string name;
+  vec3 position;
+  vec3 direction;
+  vec3 up;
+  float fovx;
+  float znear;
+  float zfar;
+};
+
+enum class material_kind_t : uint32_t { transmission, reflection, diffuse, phong };
+
+struct material_source_t {
+  string name;
+  material_kind_t kind;
+  vec3 diffuse;
+  vec3 specular;
+  float shininess;
+  float ior;
+};
+
+struct light_source_t {
+  string name;
+  vec3 position;
+  vec3 direction;
+  vec3 up;
+  vec3 exitance;
+  vec2 size;
+  bool diffuse;
+};
+
+struct scene_source_t {
+  vector<camera_source_t> cameras;
+  vector<material_source_t> materials;
+  vector<Mesh> meshes;
+  vector<Mesh> prototypes;
+  vector<Instance> instances;
+  vector<light_source_t> lights;
+};
+
+void load_cameras(const aiScene* scene, scene_source_t& source) {
   for (size_t i = 0; i < scene->mNumCameras; ++i) {
     auto camera = scene->mCameras[i];
 
-    cameras.addCameraFovX(toString(camera->mName), toVec3(camera->mPosition),
-                          normalize(toVec3(camera->mLookAt)),
-                          normalize(toVec3(camera->mUp)),
-                          camera->mHorizontalFOV * 2.0f, camera->mClipPlaneNear,
-                          camera->mClipPlaneFar);
+    mat4 transform = world_transform(scene, camera->mName);
+
+    camera_source_t result;
+    result.name = toString(camera->mName);
+    result.position = vec3(transform * vec4(toVec3(camera->mPosition), 1.0f));
+    result.direction = normalize(mat3(transform) * toVec3(camera->mLookAt));
+    result.up = normalize(mat3(transform) * toVec3(camera->mUp));
+    result.fovx = camera->mHorizontalFOV * 2.0f;
+    result.znear = camera->mClipPlaneNear;
+    result.zfar = camera->mClipPlaneFar;
+    source.cameras.push_back(result);
+  }
+}
 
-    materials.names.push_back("camera");
-    materials.bsdfs.push_back(unique<BSDF>(new CameraBSDF()));
+// Quads are kept only if they are planar and convex, so the two triangles
+// Embree splits them into (along the 1-3 diagonal) match the face.
+bool is_planar_quad(const aiMesh* mesh, const aiFace& face) {
+  vec3 p[4];
+
+  for (size_t k = 0; k < 4; ++k) {
+    p[k] = toVec3(mesh->mVertices[face.mIndices[k]]);
+  }
+
+  vec3 normal = cross(p[2] - p[0], p[3] - p[1]);
+  float length = glm::length(normal);
+
+  if (length == 0.0f) {
+    return false;
+  }
+
+  normal /= length;
+
+  float diagonal = glm::max(distance(p[0], p[2]), distance(p[1], p[3]));
+  vec3 center = (p[0] + p[1] + p[2] + p[3]) * 0.25f;
+
+  for (size_t k = 0; k < 4; ++k) {
+    if (glm::abs(dot(p[k] - center, normal)) > diagonal * 1e-4f) {
+      return false;
+    }
+
+    vec3 edge0 = p[(k + 1) % 4] - p[k];
+    vec3 edge1 = p[(k + 2) % 4] - p[(k + 1) % 4];
+
+    if (dot(cross(edge0, edge1), normal) <= 0.0f) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Splits a polygon into triangles by ear clipping, so concave faces are
+// split along diagonals that stay inside them. The polygon is projected on
+// the plane given by its Newell normal. If no ear is found (degenerate or
+// self-intersecting faces) the rest is fanned.
+void triangulate_polygon(const aiVector3D* vertices, const unsigned* indices,
+                         size_t size, vector<int>& triangles) {
+  vector<vec3> p(size);
+  vec3 normal = vec3(0.0f);
+
+  for (size_t k = 0; k < size; ++k) {
+    p[k] = toVec3(vertices[indices[k]]);
+  }
+
+  for (size_t k = 0; k < size; ++k) {
+    normal += cross(p[k], p[(k + 1) % size]);
+  }
+
+  auto convex = [&](size_t a, size_t b, size_t c) {
+    return dot(cross(p[b] - p[a], p[c] - p[b]), normal) > 0.0f;
+  };
+
+  auto inside = [&](size_t a, size_t b, size_t c, size_t k) {
+    return dot(cross(p[b] - p[a], p[k] - p[a]), normal) >= 0.0f &&
+           dot(cross(p[c] - p[b], p[k] - p[b]), normal) >= 0.0f &&
+           dot(cross(p[a] - p[c], p[k] - p[c]), normal) >= 0.0f;
+  };
+
+  vector<size_t> remaining(size);
+
+  for (size_t k = 0; k < size; ++k) {
+    remaining[k] = k;
+  }
+
+  while (remaining.size() > 3) {
+    size_t n = remaining.size();
+    size_t ear = n;
+
+    for (size_t k = 0; k < n && ear == n; ++k) {
+      size_t a = remaining[(k + n - 1) % n];
+      size_t b = remaining[k];
+      size_t c = remaining[(k + 1) % n];
+
+      if (!convex(a, b, c)) {
+        continue;
+      }
+
+      bool empty = true;
+
+      for (size_t j = 0; j < n && empty; ++j) {
+        size_t q = remaining[j];
+
+        if (q != a && q != b && q != c && p[q] != p[a] && p[q] != p[b] &&
+            p[q] != p[c]) {
+          empty = !inside(a, b, c, q);
+        }
+      }
+
+      if (empty) {
+        ear = k;
+      }
+    }
+
+    if (ear == n) {
+      break;
+    }
+
+    triangles.push_back(indices[remaining[(ear + n - 1) % n]]);
+    triangles.push_back(indices[remaining[ear]]);
+    triangles.push_back(indices[remaining[(ear + 1) % n]]);
+    remaining.erase(remaining.begin() + ear);
+  }
+
+  for (size_t k = 2; k < remaining.size(); ++k) {
+    triangles.push_back(indices[remaining[0]]);
+    triangles.push_back(indices[remaining[k - 1]]);
+    triangles.push_back(indices[remaining[k]]);
+  }
+}
+
+unittest() {
+  // Concave quad, the reflex vertex is 1, the split has to use 1-3.
+  aiVector3D quad[] = {aiVector3D(0, 0, 0), aiVector3D(1, 0.8f, 0),
+                       aiVector3D(2, 0, 0), aiVector3D(1, 2, 0)};
+  unsigned quad_indices[] = {0, 1, 2, 3};
+  vector<int> triangles;
+  triangulate_polygon(quad, quad_indices, 4, triangles);
+
+  assert_true(triangles.size() == 6);
+
+  for (size_t j = 0; j < triangles.size(); j += 3) {
+    bool has0 = false, has2 = false;
+
+    for (size_t k = 0; k < 3; ++k) {
+      has0 = has0 || triangles[j + k] == 0;
+      has2 = has2 || triangles[j + k] == 2;
+    }
+
+    assert_false(has0 && has2);
+  }
+}
+
+unittest() {
+  // Concave pentagon (an arrow), every triangle keeps the orientation of
+  // the face and together they cover its area.
+  aiVector3D pentagon[] = {aiVector3D(0, 0, 0), aiVector3D(2, 1, 0),
+                           aiVector3D(4, 0, 0), aiVector3D(4, 3, 0),
+                           aiVector3D(0, 3, 0)};
+  unsigned pentagon_indices[] = {0, 1, 2, 3, 4};
+  vector<int> triangles;
+  triangulate_polygon(pentagon, pentagon_indices, 5, triangles);
+
+  assert_true(triangles.size() == 9);
+
+  float area = 0.0f;
+
+  for (size_t j = 0; j < triangles.size(); j += 3) {
+    vec3 a = toVec3(pentagon[triangles[j + 0]]);
+    vec3 b = toVec3(pentagon[triangles[j + 1]]);
+    vec3 c = toVec3(pentagon[triangles[j + 2]]);
+    float z = cross(b - a, c - a).z;
+    assert_true(z > 0.0f);
+    area += z * 0.5f;
+  }
+
+  assert_almost_eq(area, 10.0f);
+}
+
+// Splits the faces of the mesh into triangles and quads (points and lines
+// are dropped). The mesh is stored as quads if most of its faces are planar
+// quads, the remaining triangles become degenerate quads (last vertex
+// repeated) which Embree handles natively.
+vector<int> mesh_faces(const aiMesh* mesh, bool& quads) {
+  vector<int> triangles;
+  vector<int> planar;
+
+  for (size_t j = 0; j < mesh->mNumFaces; ++j) {
+    const aiFace& face = mesh->mFaces[j];
+
+    if (face.mNumIndices == 4 && is_planar_quad(mesh, face)) {
+      planar.insert(planar.end(), face.mIndices, face.mIndices + 4);
+    } else if (face.mNumIndices >= 3) {
+      triangulate_polygon(mesh->mVertices, face.mIndices, face.mNumIndices,
+                          triangles);
+    }
+  }
+
+  quads = planar.size() / 4 >= triangles.size() / 3 && !planar.empty();
+
+  if (quads) {
+    for (size_t j = 0; j < triangles.size(); j += 3) {
+      planar.insert(planar.end(), triangles.begin() + j,
+                    triangles.begin() + j + 3);
+      planar.push_back(triangles[j + 2]);
+    }
+
+    return planar;
+  } else {
+    for (size_t j = 0; j < planar.size(); j += 4) {
+      int quad[6] = {planar[j + 0], planar[j + 1], planar[j + 3],
+                     planar[j + 2], planar[j + 3], planar[j + 1]};
+      triangles.insert(triangles.end(), quad, quad + 6);
+    }
+
+    return triangles;
   }
 }
 
 Mesh aiMeshToMesh(const aiMesh* mesh, uint32_t materials_base,
-                  entity_type type) {
+                  entity_type type, const mat4& transform = mat4(1.0f)) {
   runtime_assert(mesh != nullptr);
   runtime_assert(mesh->mNormals != nullptr);
   runtime_assert(mesh->mVertices != nullptr);
 
   Mesh result;
+  vector<int> faces = mesh_faces(mesh, result.quads);
+  size_t face_size = result.quads ? 4 : 3;
+  vector<mat3> frames;
 
   if (mesh->mBitangents == nullptr || mesh->mTangents == nullptr) {
-    result.indices.resize(mesh->mNumFaces * 3);
-    result.tangents.resize(mesh->mNumFaces * 3);
-    result.vertices.resize(mesh->mNumFaces * 3);
-
-    for (size_t j = 0; j < mesh->mNumFaces; ++j) {
-      runtime_assert(mesh->mFaces[j].mNumIndices == 3);
-
-      for (size_t k = 0; k < 3; ++k) {
-        unsigned index = mesh->mFaces[j].mIndices[k];
-        result.indices[j * 3 + k] = int(j * 3 + k);
-        result.tangents[j * 3 + k][1] = toVec3(mesh->mNormals[index]);
-        result.vertices[j * 3 + k] = toVec3(mesh->mVertices[index]);
+    result.indices.resize(faces.size());
+    frames.resize(faces.size());
+    result.vertices.resize(faces.size());
+
+    for (size_t j = 0; j < faces.size(); j += face_size) {
+      for (size_t k = j; k < j + face_size; ++k) {
+        unsigned index = faces[k];
+        result.indices[k] = int(k);
+        frames[k][1] = toVec3(mesh->mNormals[index]);
+        result.vertices[k] = vec4(toVec3(mesh->mVertices[index]), 1.0f);
       }
 
-      vec3 edge = result.vertices[j * 3 + 1] - result.vertices[j * 3 + 0];
+      vec3 edge = vec3(result.vertices[j + 1] - result.vertices[j + 0]);
 
-      for (size_t k = 0; k < 3; ++k) {
-        vec3 normal = result.tangents[j * 3 + k][1];
+      for (size_t k = j; k < j + face_size; ++k) {
+        vec3 normal = frames[k][1];
         vec3 tangent = normalize(edge - dot(normal, edge) * normal);
         vec3 bitangent = normalize(cross(normal, tangent));
-        result.tangents[j * 3 + k][2] = bitangent;
-        result.tangents[j * 3 + k][0] = tangent;
+        frames[k][2] = bitangent;
+        frames[k][0] = tangent;
       }
     }
   } else {
-    result.tangents.resize(mesh->mNumVertices);
+    frames.resize(mesh->mNumVertices);
     result.vertices.resize(mesh->mNumVertices);
 
     for (size_t j = 0; j < mesh->mNumVertices; ++j) {
-      result.tangents[j][0] = toVec3(mesh->mTangents[j]);
-      result.tangents[j][1] = toVec3(mesh->mNormals[j]);
-      result.tangents[j][2] = toVec3(mesh->mBitangents[j]);
-      result.vertices[j] = toVec3(mesh->mVertices[j]);
+      frames[j][0] = toVec3(mesh->mTangents[j]);
+      frames[j][1] = toVec3(mesh->mNormals[j]);
+      frames[j][2] = toVec3(mesh->mBitangents[j]);
+      result.vertices[j] = vec4(toVec3(mesh->mVertices[j]), 1.0f);
     }
 
-    result.indices.resize(mesh->mNumFaces * 3);
+    result.indices = move(faces);
+  }
 
-    for (size_t j = 0; j < mesh->mNumFaces; ++j) {
-      runtime_assert(mesh->mFaces[j].mNumIndices == 3);
+  if (transform != mat4(1.0f)) {
+    mat3 linear = mat3(transform);
+    mat3 normal_matrix = transpose(inverse(linear));
 
-      for (size_t k = 0; k < 3; ++k) {
-        result.indices[j * 3 + k] = mesh->mFaces[j].mIndices[k];
-      }
+    for (auto&& vertex : result.vertices) {
+      vertex = transform * vertex;
+    }
+
+    for (auto&& frame : frames) {
+      frame = mat3(linear * frame[0], normal_matrix * frame[1],
+                   linear * frame[2]);
     }
   }
 
+  result.tangents.resize(frames.size());
+
+  for (size_t j = 0; j < frames.size(); ++j) {
+    result.tangents[j] = pack_frame(frames[j]);
+  }
+
   result.name = mesh->mName.C_Str();
   result.material_id =
       encode_material(mesh->mMaterialIndex + materials_base, type);
@@ -368,62 +663,159 @@ Mesh aiMeshToMesh(const aiMesh* mesh, uint32_t materials_base,
   return result;
 }
 
-void load_meshes(const aiScene* scene, Materials& materials,
-                 vector<Mesh>& meshes) {
-  uint32_t materials_base = materials.names.size();
+void load_meshes(const aiScene* scene, scene_source_t& source,
+                 threadpool_t& pool) {
+  // Cameras take the first material slots.
+  uint32_t materials_base = uint32_t(source.cameras.size());
 
   for (size_t i = 0; i < scene->mNumMaterials; ++i) {
     const aiMaterial* material = scene->mMaterials[i];
 
-    materials.names.push_back(name(scene->mMaterials[i]));
+    material_source_t result;
+    result.name = name(material);
+    result.diffuse = diffuse(material);
+    result.specular = specular(material);
+    result.shininess = shininess(material);
+    result.ior = 1.0f;
 
     if (property<bool>(material, "$mat.blend.transparency.use")) {
-      float ior = property<float>(material, "$mat.blend.transparency.ior");
-      auto bsdf = unique<BSDF>(new TransmissionBSDF(ior, 1.0f));
-      materials.bsdfs.push_back(std::move(bsdf));
+      result.kind = material_kind_t::transmission;
+      result.ior = property<float>(material, "$mat.blend.transparency.ior");
     } else if (property<bool>(material, "$mat.blend.mirror.use")) {
-      materials.bsdfs.push_back(unique<BSDF>(new ReflectionBSDF()));
-    } else if (specular(material) == vec3(0.0f)) {
-      materials.bsdfs.push_back(
-          unique<BSDF>(new DiffuseBSDF(diffuse(material))));
+      result.kind = material_kind_t::reflection;
+    } else if (result.specular == vec3(0.0f)) {
+      result.kind = material_kind_t::diffuse;
     } else {
-      vec3 total = specular(material) + diffuse(material);
+      result.kind = material_kind_t::phong;
+      vec3 total = result.specular + result.diffuse;
 
       if (total.x > 1.0f || total.y > 1.0f || total.z > 1.0f) {
-        std::cerr << "Invalid material: " << name(scene->mMaterials[i]) << " "
-                  << specular(material) + diffuse(material) << std::endl;
+        std::cerr << "Invalid material: " << result.name << " "
+                  << total << std::endl;
       }
+    }
+
+    source.materials.push_back(result);
+  }
+
+  // Every placement of a mesh in the node graph, with its world transform.
+  vector<vector<mat4>> placements(scene->mNumMeshes);
+  vector<std::pair<const aiNode*, mat4>> stack = {{scene->mRootNode, mat4(1.0f)}};
 
-      materials.bsdfs.push_back(unique<BSDF>(new PhongBSDF(
-          diffuse(material), specular(material), shininess(material))));
+  while (!stack.empty()) {
+    const aiNode* node = stack.back().first;
+    mat4 transform = stack.back().second * toMat4(node->mTransformation);
+    stack.pop_back();
+
+    for (size_t i = 0; i < node->mNumMeshes; ++i) {
+      placements[node->mMeshes[i]].push_back(transform);
+    }
+
+    for (size_t i = node->mNumChildren; i != 0; --i) {
+      stack.emplace_back(node->mChildren[i - 1], transform);
     }
   }
 
+  // Meshes placed once are transformed to the world space, meshes placed
+  // more than once are kept in object space and instanced.
+  vector<size_t> slots(scene->mNumMeshes);
+
   for (size_t i = 0; i < scene->mNumMeshes; ++i) {
-    meshes.push_back(
-        aiMeshToMesh(scene->mMeshes[i], materials_base, entity_type::mesh));
+    if (placements[i].size() == 1) {
+      slots[i] = source.meshes.size();
+      source.meshes.emplace_back();
+    } else if (placements[i].size() > 1) {
+      uint32_t prototype = uint32_t(source.prototypes.size());
+      slots[i] = prototype;
+      source.prototypes.emplace_back();
+
+      for (auto&& transform : placements[i]) {
+        source.instances.push_back({prototype, transform});
+      }
+    }
+  }
+
+  // The conversion (tangent frames, transforms) is independent per mesh.
+  vector<std::exception_ptr> errors(scene->mNumMeshes);
+
+  exec1d(pool, scene->mNumMeshes, 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      try {
+        if (placements[i].size() == 1) {
+          source.meshes[slots[i]] =
+              aiMeshToMesh(scene->mMeshes[i], materials_base,
+                           entity_type::mesh, placements[i].front());
+        } else if (placements[i].size() > 1) {
+          source.prototypes[slots[i]] = aiMeshToMesh(
+              scene->mMeshes[i], materials_base, entity_type::mesh);
+        }
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    }
+  });
+
+  for (auto&& error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
   }
 }
 
-bounding_sphere_t compute_bounding_sphere(const std::vector<Mesh>& meshes) {
-  bounding_sphere_t result = {vec3(0.0f), 0.0f};
-  size_t num_vertices = 0;
+bounding_sphere_t compute_bounding_sphere(const scene_source_t& source,
+                                          threadpool_t& pool) {
+  // Meshes first, then the instances. Partial results are kept per item
+  // and reduced in order, so the result doesn't depend on the scheduling.
+  size_t num_items = source.meshes.size() + source.instances.size();
 
-  for (auto&& mesh : meshes) {
-    for (auto&& vertex : mesh.vertices) {
-      result.center += vertex;
+  auto for_each_vertex = [&](size_t item, const auto& func) {
+    if (item < source.meshes.size()) {
+      for (auto&& vertex : source.meshes[item].vertices) {
+        func(vec3(vertex));
+      }
+    } else {
+      auto& instance = source.instances[item - source.meshes.size()];
+
+      for (auto&& vertex : source.prototypes[instance.prototype].vertices) {
+        func(vec3(instance.transform * vertex));
+      }
+    }
+  };
+
+  vector<dvec3> sums(num_items, dvec3(0.0));
+  vector<size_t> counts(num_items, 0);
+
+  exec1d(pool, num_items, 16, [&](size_t begin, size_t end) {
+    for (size_t item = begin; item < end; ++item) {
+      for_each_vertex(item, [&](const vec3& vertex) {
+        sums[item] += dvec3(vertex);
+        ++counts[item];
+      });
     }
+  });
+
+  dvec3 sum = dvec3(0.0);
+  size_t num_vertices = 0;
 
-    num_vertices += mesh.vertices.size();
+  for (size_t item = 0; item < num_items; ++item) {
+    sum += sums[item];
+    num_vertices += counts[item];
   }
 
-  result.center /= static_cast<float>(num_vertices);
+  bounding_sphere_t result = {vec3(sum / double(num_vertices)), 0.0f};
+  vector<float> radii(num_items, 0.0f);
 
-  for (auto&& mesh : meshes) {
-    for (auto&& vertex : mesh.vertices) {
-      result.radius =
-          glm::max(result.radius, glm::distance2(result.center, vertex));
+  exec1d(pool, num_items, 16, [&](size_t begin, size_t end) {
+    for (size_t item = begin; item < end; ++item) {
+      for_each_vertex(item, [&](const vec3& vertex) {
+        radii[item] =
+            glm::max(radii[item], glm::distance2(result.center, vertex));
+      });
     }
+  });
+
+  for (float radius : radii) {
+    result.radius = glm::max(result.radius, radius);
   }
 
   result.radius = glm::sqrt(result.radius);
@@ -431,58 +823,340 @@ bounding_sphere_t compute_bounding_sphere(const std::vector<Mesh>& meshes) {
   return result;
 }
 
-void load_lights(const aiScene* scene, Materials& materials, AreaLights& lights,
-                 vector<Mesh>& meshes) {
-  auto bounding_sphere = compute_bounding_sphere(meshes);
-
+void load_lights(const aiScene* scene, scene_source_t& source) {
   for (size_t i = 0; i < scene->mNumLights; ++i) {
     if (scene->mLights[i]->mType == aiLightSource_AREA) {
       auto light = scene->mLights[i];
 
-      lights.addLight(
-          toString(light->mName), materials.names.size(),
-          toVec3(light->mPosition), normalize(toVec3(light->mDirection)),
-          normalize(toVec3(light->mUp)), toVec3(light->mColorDiffuse),
-          toVec2(light->mSize), light->mDiffuse);
+      mat4 transform = world_transform(scene, light->mName);
+
+      light_source_t result;
+      result.name = toString(light->mName);
+      result.position = vec3(transform * vec4(toVec3(light->mPosition), 1.0f));
+      result.direction = normalize(mat3(transform) * toVec3(light->mDirection));
+      result.up = normalize(mat3(transform) * toVec3(light->mUp));
+      result.exitance = toVec3(light->mColorDiffuse);
+      result.size = toVec2(light->mSize);
+      result.diffuse = light->mDiffuse;
+      source.lights.push_back(result);
+    }
+  }
+}
+
+shared<Scene> build_scene(scene_source_t&& source, threadpool_t& pool) {
+  Materials materials;
+  Cameras cameras;
+
+  for (auto&& camera : source.cameras) {
+    cameras.addCameraFovX(camera.name, camera.position, camera.direction,
+                          camera.up, camera.fovx, camera.znear, camera.zfar);
 
-      meshes.push_back(lights.light(i).create_mesh(materials.names.size(),
-                                                   toString(light->mName)));
+    materials.names.push_back("camera");
+    materials.bsdfs.push_back(unique<BSDF>(new CameraBSDF()));
+  }
 
-      materials.names.push_back(toString(light->mName));
-      materials.bsdfs.push_back(
-          lights.light(i).create_bsdf(bounding_sphere, i, light->mDiffuse));
+  for (auto&& material : source.materials) {
+    materials.names.push_back(material.name);
+
+    switch (material.kind) {
+      case material_kind_t::transmission:
+        materials.bsdfs.push_back(
+            unique<BSDF>(new TransmissionBSDF(material.ior, 1.0f)));
+        break;
+      case material_kind_t::reflection:
+        materials.bsdfs.push_back(unique<BSDF>(new ReflectionBSDF()));
+        break;
+      case material_kind_t::diffuse:
+        materials.bsdfs.push_back(
+            unique<BSDF>(new DiffuseBSDF(material.diffuse)));
+        break;
+      default:
+        materials.bsdfs.push_back(unique<BSDF>(new PhongBSDF(
+            material.diffuse, material.specular, material.shininess)));
+        break;
     }
   }
+
+  auto bounding_sphere = compute_bounding_sphere(source, pool);
+  vector<Mesh> meshes = std::move(source.meshes);
+
+  AreaLights lights;
+
+  for (size_t i = 0; i < source.lights.size(); ++i) {
+    auto& light = source.lights[i];
+
+    lights.addLight(light.name, materials.names.size(), light.position,
+                    light.direction, light.up, light.exitance, light.size,
+                    light.diffuse);
+
+    meshes.push_back(lights.light(i).create_mesh(materials.names.size(),
+                                                 light.name));
+
+    materials.names.push_back(light.name);
+    materials.bsdfs.push_back(
+        lights.light(i).create_bsdf(bounding_sphere, i, light.diffuse));
+  }
+
+  return make_shared<Scene>(move(cameras), move(materials), move(meshes),
+                            move(lights), move(source.prototypes),
+                            move(source.instances));
+}
+
+static const char scene_cache_magic[8] = {'H', 'S', 'C', 'E', 'N', 'E', '\0', '\5'};
+
+string scene_cache_path(const string& path) { return path + ".cache"; }
+
+void write_meshes(binary_writer_t& writer, const vector<Mesh>& meshes) {
+  writer.write(uint64_t(meshes.size()));
+
+  for (auto&& mesh : meshes) {
+    writer.write(mesh.name);
+    writer.write(&mesh.material_id, sizeof(mesh.material_id));
+    writer.write(uint64_t(mesh.quads));
+    writer.write_vector(mesh.indices);
+    writer.write_vector(mesh.vertices);
+    writer.write_vector(mesh.tangents);
+  }
 }
 
-shared<Scene> loadScene(string path) {
+void read_meshes(binary_reader_t& reader, vector<Mesh>& meshes) {
+  meshes.resize(size_t(reader.read_u64()));
+
+  for (auto&& mesh : meshes) {
+    mesh.name = reader.read_string();
+    reader.read(&mesh.material_id, sizeof(mesh.material_id));
+    mesh.quads = reader.read_u64() != 0;
+    reader.read_vector(mesh.indices);
+    reader.read_vector(mesh.vertices);
+    reader.read_vector(mesh.tangents);
+  }
+}
+
+void save_scene_cache(const string& path, const scene_source_t& source) {
+  string cache = scene_cache_path(path);
+  // Farm workers may import the same scene concurrently.
+  string temp = cache + "." + std::to_string(std::random_device()()) + ".tmp";
+  FILE* file = fopen(temp.c_str(), "wb");
+
+  if (file == nullptr) {
+    throw std::runtime_error("failed to open " + temp);
+  }
+
+  try {
+    binary_writer_t writer = {file};
+    writer.write(scene_cache_magic, sizeof(scene_cache_magic));
+    writer.write(uint64_t(getmtime(path)));
+    writer.write(uint64_t(getsize(path)));
+
+    writer.write(uint64_t(source.cameras.size()));
+
+    for (auto&& camera : source.cameras) {
+      writer.write(camera.name);
+      writer.write(&camera.position, sizeof(camera.position));
+      writer.write(&camera.direction, sizeof(camera.direction));
+      writer.write(&camera.up, sizeof(camera.up));
+      writer.write(&camera.fovx, sizeof(camera.fovx));
+      writer.write(&camera.znear, sizeof(camera.znear));
+      writer.write(&camera.zfar, sizeof(camera.zfar));
+    }
+
+    writer.write(uint64_t(source.materials.size()));
+
+    for (auto&& material : source.materials) {
+      writer.write(material.name);
+      writer.write(&material.kind, sizeof(material.kind));
+      writer.write(&material.diffuse, sizeof(material.diffuse));
+      writer.write(&material.specular, sizeof(material.specular));
+      writer.write(&material.shininess, sizeof(material.shininess));
+      writer.write(&material.ior, sizeof(material.ior));
+    }
+
+    write_meshes(writer, source.meshes);
+    write_meshes(writer, source.prototypes);
+    writer.write_vector(source.instances);
+
+    writer.write(uint64_t(source.lights.size()));
+
+    for (auto&& light : source.lights) {
+      uint32_t diffuse = light.diffuse;
+      writer.write(light.name);
+      writer.write(&light.position, sizeof(light.position));
+      writer.write(&light.direction, sizeof(light.direction));
+      writer.write(&light.up, sizeof(light.up));
+      writer.write(&light.exitance, sizeof(light.exitance));
+      writer.write(&light.size, sizeof(light.size));
+      writer.write(&diffuse, sizeof(diffuse));
+    }
+  } catch (...) {
+    fclose(file);
+    std::remove(temp.c_str());
+    throw;
+  }
+
+  if (fclose(file) != 0) {
+    throw std::runtime_error("failed to write " + temp);
+  }
+
+  move_file(temp, cache);
+}
+
+// Returns false if there is no cache or it is stale (the source was
+// modified after the cache was written). The arrays are copied out of the
+// mapping, the meshes own their buffers because Embree references them.
+bool load_scene_cache(const string& path, scene_source_t& source) {
+  string cache = scene_cache_path(path);
+
+  if (!isfile(cache)) {
+    return false;
+  }
+
+  mapped_file_t file(cache);
+  binary_reader_t reader = {file.data(), file.data() + file.size()};
+
+  char magic[sizeof(scene_cache_magic)];
+  reader.read(magic, sizeof(magic));
+
+  if (std::memcmp(magic, scene_cache_magic, sizeof(magic)) != 0 ||
+      reader.read_u64() != getmtime(path) ||
+      reader.read_u64() != getsize(path)) {
+    return false;
+  }
+
+  source.cameras.resize(size_t(reader.read_u64()));
+
+  for (auto&& camera : source.cameras) {
+    camera.name = reader.read_string();
+    reader.read(&camera.position, sizeof(camera.position));
+    reader.read(&camera.direction, sizeof(camera.direction));
+    reader.read(&camera.up, sizeof(camera.up));
+    reader.read(&camera.fovx, sizeof(camera.fovx));
+    reader.read(&camera.znear, sizeof(camera.znear));
+    reader.read(&camera.zfar, sizeof(camera.zfar));
+  }
+
+  source.materials.resize(size_t(reader.read_u64()));
+
+  for (auto&& material : source.materials) {
+    material.name = reader.read_string();
+    reader.read(&material.kind, sizeof(material.kind));
+    reader.read(&material.diffuse, sizeof(material.diffuse));
+    reader.read(&material.specular, sizeof(material.specular));
+    reader.read(&material.shininess, sizeof(material.shininess));
+    reader.read(&material.ior, sizeof(material.ior));
+  }
+
+  read_meshes(reader, source.meshes);
+  read_meshes(reader, source.prototypes);
+  reader.read_vector(source.instances);
+
+  for (auto&& instance : source.instances) {
+    if (instance.prototype >= source.prototypes.size()) {
+      throw std::runtime_error("invalid instance in " + cache);
+    }
+  }
+
+  source.lights.resize(size_t(reader.read_u64()));
+
+  for (auto&& light : source.lights) {
+    uint32_t diffuse = 0;
+    light.name = reader.read_string();
+    reader.read(&light.position, sizeof(light.position));
+    reader.read(&light.direction, sizeof(light.direction));
+    reader.read(&light.up, sizeof(light.up));
+    reader.read(&light.exitance, sizeof(light.exitance));
+    reader.read(&light.size, sizeof(light.size));
+    reader.read(&diffuse, sizeof(diffuse));
+    light.diffuse = diffuse != 0;
+  }
+
+  return true;
+}
+
+shared<Scene> loadScene(string path, bool use_cache, size_t num_threads) {
+  threadpool_t pool(num_threads);
+  scene_source_t source;
+  scene_load_times_t times;
+
+  if (use_cache) {
+    try {
+      bool cached = false;
+
+      {
+        time_scope_t scope(times.import);
+        cached = load_scene_cache(path, source);
+      }
+
+      if (cached) {
+        process_startup_report().mark("import");
+        shared<Scene> scene;
+
+        {
+          time_scope_t scope(times.conversion);
+          scene = build_scene(move(source), pool);
+        }
+
+        process_startup_report().mark("scene setup");
+
+        scene->loadTimes = times;
+        return scene;
+      }
+    } catch (const std::exception& error) {
+      std::cerr << "Ignoring scene cache: " << error.what() << std::endl;
+    }
+
+    source = scene_source_t();
+  }
+
   Assimp::Importer importer;
 
-  auto flags = aiProcess_Triangulate | aiProcess_GenNormals |
-               aiProcess_JoinIdenticalVertices | aiProcess_PreTransformVertices;
+  // Polygons are split in mesh_faces, planar quads are kept. The node
+  // graph is not flattened, load_meshes instances repeated meshes.
+  auto flags = aiProcess_GenNormals | aiProcess_JoinIdenticalVertices;
 
-  const aiScene* scene = importer.ReadFile(path, flags);
+  const aiScene* scene = nullptr;
+
+  {
+    time_scope_t scope(times.import);
+    scene = importer.ReadFile(path, flags);
+  }
 
-  using namespace std;
+  process_startup_report().mark("import");
 
   if (!scene) {
     throw std::runtime_error("Cannot load \"" + path + "\" scene.");
   }
 
-  Materials materials;
+  {
+    time_scope_t scope(times.conversion);
+    load_cameras(scene, source);
+    load_meshes(scene, source, pool);
+    load_lights(scene, source);
+  }
 
-  Cameras cameras;
-  load_cameras(scene, materials, cameras);
+  importer.FreeScene();
+  process_startup_report().mark("conversion");
 
-  vector<Mesh> meshes;
-  load_meshes(scene, materials, meshes);
+  if (use_cache) {
+    try {
+      time_scope_t scope(times.cache);
+      save_scene_cache(path, source);
+    } catch (const std::exception& error) {
+      std::cerr << "Cannot write scene cache: " << error.what() << std::endl;
+    }
 
-  AreaLights lights;
-  load_lights(scene, materials, lights, meshes);
+    process_startup_report().mark("cache write");
+  }
+
+  shared<Scene> result;
+
+  {
+    time_scope_t scope(times.conversion);
+    result = build_scene(move(source), pool);
+  }
 
-  shared<Scene> result = make_shared<Scene>(move(cameras), move(materials),
-                                            move(meshes), move(lights));
+  process_startup_report().mark("scene setup");
 
+  result->loadTimes = times;
   return result;
 }
 
@@ -3,7 +3,13 @@
 
 namespace haste {
 
-shared<Scene> loadScene(string path);
+// Scenes are cached in <path>.cache (keyed by the mtime and size of the
+// source), a plain binary file that is read through mmap and copied into
+// the scene, so a cached scene is loaded without Assimp. Meshes are
+// converted on num_threads threads, the time spent in every stage is in
+// loadTimes.
+shared<Scene> loadScene(string path, bool use_cache = true,
+                        size_t num_threads = 1);
 
 struct Triangle {
     vec3 vertices[3];
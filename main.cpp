@@ -2,8 +2,6 @@
 #include <pmmintrin.h>
 #include <runtime_assert>
 
-#include <unittest>
-
 #include <Application.hpp>
 
 #include <make_technique.hpp>
@@ -15,46 +13,15 @@
 #include <set>
 #include <mutex>
 
+#include <checkpoint.hpp>
 #include <exr.hpp>
+#include <farm.hpp>
 #include <gnuplot.hpp>
+#include <system_utils.hpp>
 
 using namespace std;
 using namespace haste;
 
-unittest() {
-  #if defined _MSC_VER
-	#pragma warning( disable : 4723)
-  #endif
-
-    // check if everything is configured well
-    assert_almost_eq(sin(half_pi<float>()), 1.0f);
-    assert_almost_eq(asin(1.0f), half_pi<float>());
-
-    #if !defined _MSC_VER
-    assert_true(std::isinf(1.0f / 0.0f));
-    assert_false(std::isnan(1.0f / 1.0f));
-    assert_true(std::isnan(0.0f / 0.0f));
-    assert_true(std::isnan(-0.0f / 0.0f));
-    #endif
-}
-
-unittest() {
-    // default constructed matrix is identity matrix
-    assert_almost_eq(mat4() * vec4(1.0f, 2.0f, 3.0f, 4.0f), vec4(1.0f, 2.0f, 3.0f, 4.0f));
-
-    // matrix indexing is column major
-    mat4 m;
-    m[0] = vec4(1.0f, 1.0f, 0.0f, 0.0f);
-
-    // 1 0 0 0
-    // 1 1 0 0
-    // 0 0 1 0
-    // 0 0 0 1
-    // ^
-
-    assert_almost_eq(m * vec4(1.0f), vec4(1.0f, 2.0f, 1.0f, 1.0f));
-}
-
 int run_fast(Options options) {
     return 0;
 }
@@ -64,9 +31,6 @@ int compute_errors(std::ostream& stream, const Options& options);
 int compute_relative_error(const Options& options);
 
 int main(int argc, char **argv) {
-    if (!run_all_tests())
-        return 1;
-
     _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
     _MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
 
@@ -77,6 +41,10 @@ int main(int argc, char **argv) {
         return status.second;
     }
 
+    process_startup_report().mark("parse args");
+
+    set_exr_threads(options.exr_threads);
+
     if (options.action == Options::Average) {
         vec3 average = exr_average(options.input0);
         std::cout << "[" << average.x << " " << average.y << " " << average.z << "]" << std::endl;
@@ -94,12 +62,10 @@ int main(int argc, char **argv) {
         std::cout << query_time(options.input0);
     }
     else if (options.action == Options::Statistics) {
-      auto metadata = load_metadata(options.input0);
-      print_records_tabular(std::cout, statistics_t(metadata));
+      print_records_tabular(std::cout, load_statistics(options.input0));
     }
     else if (options.action == Options::Measurements) {
-      auto metadata = load_metadata(options.input0);
-      print_measurements_tabular(std::cout, statistics_t(metadata));
+      print_measurements_tabular(std::cout, load_statistics(options.input0));
     }
     else if (options.action == Options::Traces) {
       auto metadata = load_metadata(options.input0);
@@ -125,7 +91,23 @@ int main(int argc, char **argv) {
     }
     else {
         if (options.action == Options::Continue) {
-            map<string, string> metadata = load_metadata(options.input0);
+            map<string, string> metadata;
+
+            if (isfile(checkpoint_path(options.input0))) {
+                checkpoint_t checkpoint;
+                load_checkpoint(checkpoint_path(options.input0), checkpoint, false);
+                metadata = checkpoint.metadata;
+            }
+            else {
+                metadata = load_metadata(options.input0);
+
+                // Half outputs hold normalized colors, not the sums.
+                if (Options(metadata).exr_half) {
+                    std::cerr << options.input0 << " was saved with --exr-half and has no checkpoint, it can't be continued." << std::endl;
+                    return 1;
+                }
+            }
+
             auto output = options.input0;
             options = Options(metadata);
             options.output = output;
@@ -141,6 +123,10 @@ int main(int argc, char **argv) {
             }
         }
 
+        if (options.num_workers != 0) {
+            return run_farm(options, argc, argv);
+        }
+
         Application application(options);
 
         if (options.batch) {
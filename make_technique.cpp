@@ -89,6 +89,8 @@ shared<Technique> make_bpt_technique(const shared<const Scene>& scene, const Opt
         options.lights,
         options.roulette,
         options.beta,
+        options.max_path,
+        options.light_cache,
         options.num_threads);
 }
 
@@ -103,6 +105,7 @@ shared<Technique> make_upg_technique(const shared<const Scene>& scene, const Opt
         options.lights,
         options.roulette,
         options.num_photons,
+        options.auto_tune,
         options.radius,
         options.alpha,
         options.beta,
@@ -166,11 +169,17 @@ shared<Technique> makeTechnique(const shared<const Scene>& scene, Options& optio
       options.sky_horizon,
       options.sky_zenith);
 
+    result->set_traversal_order(
+      options.tile_order,
+      options.pixel_order);
+
+    result->set_spp_per_frame(options.spp_per_frame);
+
     return result;
 }
 
 shared<Scene> loadScene(const Options& options) {
-    return loadScene(options.input0);
+    return loadScene(options.input0, options.scene_cache, options.num_threads);
 }
 
 }
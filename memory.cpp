@@ -0,0 +1,125 @@
+#include <atomic>
+#include <iomanip>
+#include <ostream>
+#include <unittest>
+#include <memory.hpp>
+
+namespace haste {
+
+namespace {
+const size_t num_tags = size_t(memory_tag_t::count);
+
+std::atomic<int64_t> live_bytes[num_tags];
+std::atomic<int64_t> peak_bytes[num_tags];
+}
+
+const char* to_string(memory_tag_t tag) {
+  switch (tag) {
+    case memory_tag_t::framebuffer:
+      return "framebuffer";
+    case memory_tag_t::light_paths:
+      return "light_paths";
+    case memory_tag_t::light_offsets:
+      return "light_offsets";
+    case memory_tag_t::photon_grid:
+      return "photon_grid";
+    case memory_tag_t::kd_tree:
+      return "kd_tree";
+    case memory_tag_t::bvh:
+      return "bvh";
+    case memory_tag_t::meshes:
+      return "meshes";
+    case memory_tag_t::statistics:
+      return "statistics";
+    default:
+      return "unknown";
+  }
+}
+
+void memory_allocated(memory_tag_t tag, size_t size) {
+  int64_t live = live_bytes[size_t(tag)].fetch_add(int64_t(size)) + int64_t(size);
+  int64_t peak = peak_bytes[size_t(tag)].load();
+
+  while (peak < live &&
+         !peak_bytes[size_t(tag)].compare_exchange_weak(peak, live)) {
+  }
+}
+
+void memory_released(memory_tag_t tag, size_t size) {
+  live_bytes[size_t(tag)].fetch_sub(int64_t(size));
+}
+
+memory_usage_t memory_usage(memory_tag_t tag) {
+  int64_t live = live_bytes[size_t(tag)].load();
+  int64_t peak = peak_bytes[size_t(tag)].load();
+  return {size_t(live < 0 ? 0 : live), size_t(peak < 0 ? 0 : peak)};
+}
+
+std::map<std::string, std::string> memory_usage_dict() {
+  std::map<std::string, std::string> result;
+
+  for (size_t i = 0; i < num_tags; ++i) {
+    auto tag = memory_tag_t(i);
+    auto usage = memory_usage(tag);
+    result[std::string("memory.") + to_string(tag) + ".live"] =
+        std::to_string(usage.live);
+    result[std::string("memory.") + to_string(tag) + ".peak"] =
+        std::to_string(usage.peak);
+  }
+
+  return result;
+}
+
+void print_memory_usage(std::ostream& stream) {
+  auto flags = stream.flags();
+  auto precision = stream.precision();
+
+  stream << std::fixed << std::setprecision(1);
+
+  for (size_t i = 0; i < num_tags; ++i) {
+    auto tag = memory_tag_t(i);
+    auto usage = memory_usage(tag);
+
+    stream << "  " << std::left << std::setw(16) << to_string(tag)
+           << std::right << std::setw(10)
+           << double(usage.live) / (1024.0 * 1024.0) << " MiB live"
+           << std::setw(10) << double(usage.peak) / (1024.0 * 1024.0)
+           << " MiB peak\n";
+  }
+
+  stream.flags(flags);
+  stream.precision(precision);
+}
+
+unittest() {
+  auto before = memory_usage(memory_tag_t::kd_tree);
+
+  {
+    tracked_vector<int, memory_tag_t::kd_tree> vector(256);
+    auto during = memory_usage(memory_tag_t::kd_tree);
+
+    assert_true(during.live == before.live + 256 * sizeof(int));
+    assert_true(during.peak >= during.live);
+  }
+
+  assert_true(memory_usage(memory_tag_t::kd_tree).live == before.live);
+}
+
+unittest() {
+  tracked_buffer_t<int, memory_tag_t::kd_tree> buffer;
+  buffer.resize(3);
+  buffer[0] = 1;
+  buffer[2] = 3;
+  buffer.resize(100);
+
+  assert_true(buffer.size() == 100);
+  assert_true(buffer[0] == 1 && buffer[2] == 3);
+
+  size_t capacity = buffer.capacity();
+  buffer.clear();
+  buffer.resize(10);
+
+  assert_true(buffer.capacity() == capacity);
+}
+
+}
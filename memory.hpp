@@ -0,0 +1,190 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace haste {
+
+// Live and peak bytes per subsystem. Containers account their storage with
+// tracked_allocator_t, memory owned by libraries (Embree) or by containers
+// that are shared with them is reported with memory_allocated/released.
+enum class memory_tag_t {
+  framebuffer,
+  light_paths,
+  light_offsets,
+  photon_grid,
+  kd_tree,
+  bvh,
+  meshes,
+  statistics,
+  count
+};
+
+struct memory_usage_t {
+  std::size_t live;
+  std::size_t peak;
+};
+
+const char* to_string(memory_tag_t tag);
+
+void memory_allocated(memory_tag_t tag, std::size_t size);
+void memory_released(memory_tag_t tag, std::size_t size);
+memory_usage_t memory_usage(memory_tag_t tag);
+
+std::map<std::string, std::string> memory_usage_dict();
+void print_memory_usage(std::ostream& stream);
+
+template <class T, memory_tag_t Tag>
+struct tracked_allocator_t {
+  using value_type = T;
+
+  template <class U>
+  struct rebind {
+    using other = tracked_allocator_t<U, Tag>;
+  };
+
+  tracked_allocator_t() = default;
+
+  template <class U>
+  tracked_allocator_t(const tracked_allocator_t<U, Tag>&) {}
+
+  T* allocate(std::size_t size) {
+    T* result = static_cast<T*>(::operator new(size * sizeof(T)));
+    memory_allocated(Tag, size * sizeof(T));
+    return result;
+  }
+
+  void deallocate(T* pointer, std::size_t size) {
+    memory_released(Tag, size * sizeof(T));
+    ::operator delete(pointer);
+  }
+
+  template <class U>
+  bool operator==(const tracked_allocator_t<U, Tag>&) const {
+    return true;
+  }
+
+  template <class U>
+  bool operator!=(const tracked_allocator_t<U, Tag>&) const {
+    return false;
+  }
+};
+
+template <class T, memory_tag_t Tag>
+using tracked_vector = std::vector<T, tracked_allocator_t<T, Tag>>;
+
+// Growable array for scratch data that is rewritten every frame: growing it
+// doesn't initialize the new elements and clear() keeps the capacity.
+template <class T, memory_tag_t Tag>
+class tracked_buffer_t {
+ public:
+  static_assert(std::is_trivially_destructible<T>::value,
+                "tracked_buffer_t doesn't destroy its elements");
+
+  tracked_buffer_t() = default;
+
+  tracked_buffer_t(tracked_buffer_t&& that)
+      : _data(that._data), _size(that._size), _capacity(that._capacity) {
+    that._data = nullptr;
+    that._size = 0;
+    that._capacity = 0;
+  }
+
+  tracked_buffer_t& operator=(tracked_buffer_t&& that) {
+    std::swap(_data, that._data);
+    std::swap(_size, that._size);
+    std::swap(_capacity, that._capacity);
+    return *this;
+  }
+
+  ~tracked_buffer_t() {
+    if (_data) {
+      _allocator.deallocate(_data, _capacity);
+    }
+  }
+
+  void reserve(std::size_t capacity) {
+    if (capacity > _capacity) {
+      T* data = _allocator.allocate(capacity);
+
+      if (_data) {
+        std::uninitialized_copy(_data, _data + _size, data);
+        _allocator.deallocate(_data, _capacity);
+      }
+
+      _data = data;
+      _capacity = capacity;
+    }
+  }
+
+  void resize(std::size_t size) {
+    if (size > _capacity) {
+      reserve(std::max(size, _capacity * 2));
+    }
+
+    _size = size;
+  }
+
+  void clear() { _size = 0; }
+  void emplace_back() { resize(_size + 1); }
+  void pop_back() { --_size; }
+
+  T* data() { return _data; }
+  const T* data() const { return _data; }
+  T* begin() { return _data; }
+  const T* begin() const { return _data; }
+  T* end() { return _data + _size; }
+  const T* end() const { return _data + _size; }
+
+  std::size_t size() const { return _size; }
+  std::size_t capacity() const { return _capacity; }
+  bool empty() const { return _size == 0; }
+
+  T& operator[](std::size_t index) { return _data[index]; }
+  const T& operator[](std::size_t index) const { return _data[index]; }
+
+ private:
+  tracked_buffer_t(const tracked_buffer_t&) = delete;
+  tracked_buffer_t& operator=(const tracked_buffer_t&) = delete;
+
+  tracked_allocator_t<T, Tag> _allocator;
+  T* _data = nullptr;
+  std::size_t _size = 0;
+  std::size_t _capacity = 0;
+};
+
+// Accounts a fixed amount of memory that is not allocated through
+// tracked_allocator_t for the lifetime of the object.
+class tracked_bytes_t {
+ public:
+  tracked_bytes_t(memory_tag_t tag, std::size_t size = 0)
+      : _tag(tag), _size(size) {
+    memory_allocated(_tag, _size);
+  }
+
+  ~tracked_bytes_t() { memory_released(_tag, _size); }
+
+  void reset(std::size_t size) {
+    memory_released(_tag, _size);
+    _size = size;
+    memory_allocated(_tag, _size);
+  }
+
+  std::size_t size() const { return _size; }
+
+ private:
+  tracked_bytes_t(const tracked_bytes_t&) = delete;
+  tracked_bytes_t& operator=(const tracked_bytes_t&) = delete;
+
+  memory_tag_t _tag;
+  std::size_t _size;
+};
+
+}
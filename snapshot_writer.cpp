@@ -0,0 +1,75 @@
+#include <cstring>
+#include <checkpoint.hpp>
+#include <snapshot_writer.hpp>
+
+namespace haste {
+
+snapshot_writer_t::~snapshot_writer_t() {
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+}
+
+void snapshot_writer_t::save(
+  const Options& options,
+  const statistics_t& statistics,
+  const dvec4* data,
+  const string& generator_state,
+  std::function<void()> on_saved) {
+  wait();
+
+  size_t size = options.width * options.height;
+
+  // The checkpoint needs the accumulator in full precision, in that case
+  // the conversion to float is done on the background thread as well.
+  if (options.checkpoint) {
+    _raw_buffer.resize(size);
+    std::memcpy(_raw_buffer.data(), data, size * sizeof(dvec4));
+  }
+  else {
+    _buffer.resize(size);
+
+    for (size_t i = 0; i < size; ++i) {
+      _buffer[i] = vec4(data[i]);
+    }
+  }
+
+  _thread = std::thread([this, options, statistics, generator_state, on_saved] {
+    try {
+      if (options.checkpoint) {
+        save_checkpoint(
+          checkpoint_path(options.get_output()),
+          options,
+          statistics,
+          generator_state,
+          _raw_buffer.data());
+
+        save_exr(options, statistics, _raw_buffer.data());
+      }
+      else {
+        save_exr(options, statistics, _buffer.data());
+      }
+
+      if (on_saved) {
+        on_saved();
+      }
+    }
+    catch (...) {
+      _exception = std::current_exception();
+    }
+  });
+}
+
+void snapshot_writer_t::wait() {
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+
+  if (_exception) {
+    auto exception = _exception;
+    _exception = nullptr;
+    std::rethrow_exception(exception);
+  }
+}
+
+}
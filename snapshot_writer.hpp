@@ -0,0 +1,39 @@
+#pragma once
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <Options.hpp>
+
+namespace haste {
+
+// Writes images on a background thread. The accumulator is converted to
+// a private buffer on the calling thread, the encoding and the file output
+// happen asynchronously (together with the checkpoint, if enabled). Only
+// one write is in flight at any time, save() blocks until the previous one
+// is finished.
+class snapshot_writer_t {
+ public:
+  snapshot_writer_t() = default;
+  ~snapshot_writer_t();
+
+  void save(
+    const Options& options,
+    const statistics_t& statistics,
+    const dvec4* data,
+    const string& generator_state,
+    std::function<void()> on_saved = nullptr);
+
+  void wait();
+
+ private:
+  snapshot_writer_t(const snapshot_writer_t&) = delete;
+  snapshot_writer_t& operator=(const snapshot_writer_t&) = delete;
+
+  std::thread _thread;
+  std::vector<vec4> _buffer;
+  std::vector<dvec4> _raw_buffer;
+  std::exception_ptr _exception;
+};
+
+}
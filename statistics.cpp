@@ -1,11 +1,19 @@
 #include <algorithm>
+#include <cstdio>
+#include <stdexcept>
 #include <unordered_map>
 #include <tuple>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <unittest>
 #include <statistics.hpp>
+#include <system_utils.hpp>
 #include <utility.hpp>
+#include <exr.hpp>
 
 namespace haste {
 
@@ -26,12 +34,38 @@ statistics_t::statistics_t(const map<string, string>& dict) {
   trace_eye_time = stod(dict.find("statistics.trace_eye_time")->second);
   trace_light_time = stod(dict.find("statistics.trace_light_time")->second);
 
+  auto accel_build_time_itr = dict.find("statistics.accel_build_time");
+
+  if (accel_build_time_itr != dict.end()) {
+    accel_build_time = stod(accel_build_time_itr->second);
+  }
+
+  auto num_queries_itr = dict.find("statistics.num_queries");
+
+  if (num_queries_itr != dict.end()) {
+    num_queries = stoll(num_queries_itr->second);
+  }
+
+  auto num_merges_itr = dict.find("statistics.num_merges");
+
+  if (num_merges_itr != dict.end()) {
+    num_merges = stoll(num_merges_itr->second);
+  }
+
+  auto radius_itr = dict.find("statistics.radius");
+
+  if (radius_itr != dict.end()) {
+    radius = stod(radius_itr->second);
+  }
+
   const string records_prefix = "records[";
   const string rms_error = "].rms_error";
   const string abs_error = "].abs_error";
   const string clock_time = "].clock_time";
   const string frame_duration = "].frame_duration";
   const string numeric_errors = "].numeric_errors";
+  const string record_num_photons = "].num_photons";
+  const string record_radius = "].radius";
 
   const string measurements_prefix = "measurements[";
   const string pixel_x = "].pixel_x";
@@ -75,6 +109,12 @@ statistics_t::statistics_t(const map<string, string>& dict) {
       else if (endswith(item.first, numeric_errors)) {
         records_map[index].numeric_errors = (size_t)stoll(item.second);
       }
+      else if (endswith(item.first, record_num_photons)) {
+        records_map[index].num_photons = (size_t)stoll(item.second);
+      }
+      else if (endswith(item.first, record_radius)) {
+        records_map[index].radius = (float)stod(item.second);
+      }
     }
     else if (startswith(item.first, measurements_prefix) &&
       sscanf(item.first.c_str() + measurements_prefix.size(), "%llux%llux%llu", &i, &pixel_x, &pixel_y) == 3) {
@@ -115,7 +155,7 @@ statistics_t::statistics_t(const map<string, string>& dict) {
     return a.sample_index < b.sample_index; });
 }
 
-map<string, string> statistics_t::to_dict() const {
+map<string, string> statistics_t::to_dict(bool with_series) const {
   map<string, string> result;
 
   result["statistics.num_samples"] = std::to_string(num_samples);
@@ -124,6 +164,9 @@ map<string, string> statistics_t::to_dict() const {
   result["statistics.num_tentative_rays"] = std::to_string(num_tentative_rays);
   result["statistics.num_photons"] = std::to_string(num_photons);
   result["statistics.num_scattered"] = std::to_string(num_scattered);
+  result["statistics.num_queries"] = std::to_string(num_queries);
+  result["statistics.num_merges"] = std::to_string(num_merges);
+  result["statistics.radius"] = std::to_string(radius);
   result["statistics.total_time"] = std::to_string(total_time);
   result["statistics.scatter_time"] = std::to_string(scatter_time);
   result["statistics.build_time"] = std::to_string(build_time);
@@ -133,6 +176,11 @@ map<string, string> statistics_t::to_dict() const {
   result["statistics.intersect_time"] = std::to_string(intersect_time);
   result["statistics.trace_eye_time"] = std::to_string(trace_eye_time);
   result["statistics.trace_light_time"] = std::to_string(trace_light_time);
+  result["statistics.accel_build_time"] = std::to_string(accel_build_time);
+
+  if (!with_series) {
+    return result;
+  }
 
   char prefix[128];
   char buffer[128];
@@ -150,6 +198,13 @@ map<string, string> statistics_t::to_dict() const {
     result[buffer] = std::to_string(records[i].frame_duration);
     sprintf(buffer, "records[%llu].numeric_errors", (unsigned long long)sample_index);
     result[buffer] = std::to_string(records[i].numeric_errors);
+
+    if (records[i].num_photons != 0) {
+      sprintf(buffer, "records[%llu].num_photons", (unsigned long long)sample_index);
+      result[buffer] = std::to_string(records[i].num_photons);
+      sprintf(buffer, "records[%llu].radius", (unsigned long long)sample_index);
+      result[buffer] = std::to_string(records[i].radius);
+    }
   }
 
   for (size_t i = 0; i < measurements.size(); ++i) {
@@ -174,6 +229,286 @@ map<string, string> statistics_t::to_dict() const {
   return result;
 }
 
+static const char sidecar_magic[8] = { 'H', 'S', 'T', 'A', 'T', 'S', '\0', '\1' };
+
+struct sidecar_header_t {
+  char magic[8];
+  uint32_t entry_size;
+  uint32_t reserved;
+};
+
+struct sidecar_entry_t {
+  enum : uint32_t { record = 1, measurement = 2 };
+
+  uint32_t kind;
+  int32_t pixel_x;
+  uint64_t sample_index;
+  int32_t pixel_y;
+  float rms_error;
+  float abs_error;
+  float values[3];
+  uint64_t numeric_errors;
+  uint64_t num_photons;
+};
+
+static sidecar_entry_t to_entry(const statistics_t::record_t& record) {
+  sidecar_entry_t entry;
+  std::memset(&entry, 0, sizeof(entry));
+  entry.kind = sidecar_entry_t::record;
+  entry.sample_index = record.sample_index;
+  entry.rms_error = record.rms_error;
+  entry.abs_error = record.abs_error;
+  entry.values[0] = record.clock_time;
+  entry.values[1] = record.frame_duration;
+  entry.values[2] = record.radius;
+  entry.numeric_errors = record.numeric_errors;
+  entry.num_photons = record.num_photons;
+  return entry;
+}
+
+static sidecar_entry_t to_entry(const statistics_t::measurement_t& measurement) {
+  sidecar_entry_t entry;
+  std::memset(&entry, 0, sizeof(entry));
+  entry.kind = sidecar_entry_t::measurement;
+  entry.pixel_x = measurement.pixel_x;
+  entry.pixel_y = measurement.pixel_y;
+  entry.sample_index = measurement.sample_index;
+  entry.rms_error = measurement.rms_error;
+  entry.abs_error = measurement.abs_error;
+  entry.values[0] = measurement.value.x;
+  entry.values[1] = measurement.value.y;
+  entry.values[2] = measurement.value.z;
+  return entry;
+}
+
+static void write_entries(
+  FILE* file,
+  const statistics_t& statistics,
+  size_t first_record,
+  size_t first_measurement) {
+  vector<sidecar_entry_t> entries;
+  entries.reserve(
+    statistics.records.size() - first_record +
+    statistics.measurements.size() - first_measurement);
+
+  for (size_t i = first_record; i < statistics.records.size(); ++i) {
+    entries.push_back(to_entry(statistics.records[i]));
+  }
+
+  for (size_t i = first_measurement; i < statistics.measurements.size(); ++i) {
+    entries.push_back(to_entry(statistics.measurements[i]));
+  }
+
+  if (fwrite(entries.data(), sizeof(sidecar_entry_t), entries.size(), file) != entries.size()) {
+    throw std::runtime_error("failed to write statistics");
+  }
+}
+
+string statistics_path(const string& image_path) {
+  return image_path + ".stats";
+}
+
+// The render thread appends to the sidecar every frame while the snapshot
+// thread rewrites it, every access to a sidecar goes through this mutex and
+// every rewrite uses its own temporary file.
+static std::mutex sidecar_mutex;
+static size_t sidecar_counter = 0;
+
+static void save_statistics_sidecar_locked(const string& path, const statistics_t& statistics) {
+  string temp = path + ".tmp" + std::to_string(sidecar_counter++);
+  FILE* file = fopen(temp.c_str(), "wb");
+
+  if (file == nullptr) {
+    throw std::runtime_error("failed to open " + temp);
+  }
+
+  try {
+    sidecar_header_t header;
+    std::memcpy(header.magic, sidecar_magic, sizeof(header.magic));
+    header.entry_size = sizeof(sidecar_entry_t);
+    header.reserved = 0;
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+      throw std::runtime_error("failed to write statistics");
+    }
+
+    write_entries(file, statistics, 0, 0);
+  }
+  catch (...) {
+    fclose(file);
+    throw;
+  }
+
+  fclose(file);
+  move_file(temp, path);
+}
+
+void save_statistics_sidecar(const string& path, const statistics_t& statistics) {
+  std::unique_lock<std::mutex> lock(sidecar_mutex);
+  save_statistics_sidecar_locked(path, statistics);
+}
+
+void load_statistics_sidecar(const string& path, statistics_t& statistics) {
+  mapped_file_t file(path);
+
+  sidecar_header_t header;
+
+  if (file.size() < sizeof(header)) {
+    throw std::runtime_error("invalid statistics file " + path);
+  }
+
+  std::memcpy(&header, file.data(), sizeof(header));
+
+  if (std::memcmp(header.magic, sidecar_magic, sizeof(header.magic)) != 0 ||
+      header.entry_size != sizeof(sidecar_entry_t)) {
+    throw std::runtime_error("invalid statistics file " + path);
+  }
+
+  // A trailing partial entry is what an interrupted append leaves, skip it.
+  size_t num_entries = (file.size() - sizeof(header)) / sizeof(sidecar_entry_t);
+  const char* data = file.data() + sizeof(header);
+
+  statistics.records.clear();
+  statistics.measurements.clear();
+
+  for (size_t i = 0; i < num_entries; ++i) {
+    sidecar_entry_t entry;
+    std::memcpy(&entry, data + i * sizeof(entry), sizeof(entry));
+
+    if (entry.kind == sidecar_entry_t::record) {
+      statistics_t::record_t record;
+      record.sample_index = size_t(entry.sample_index);
+      record.rms_error = entry.rms_error;
+      record.abs_error = entry.abs_error;
+      record.clock_time = entry.values[0];
+      record.frame_duration = entry.values[1];
+      record.numeric_errors = size_t(entry.numeric_errors);
+      record.num_photons = size_t(entry.num_photons);
+      record.radius = entry.values[2];
+      statistics.records.push_back(record);
+    }
+    else if (entry.kind == sidecar_entry_t::measurement) {
+      statistics_t::measurement_t measurement;
+      measurement.sample_index = size_t(entry.sample_index);
+      measurement.pixel_x = entry.pixel_x;
+      measurement.pixel_y = entry.pixel_y;
+      measurement.rms_error = entry.rms_error;
+      measurement.abs_error = entry.abs_error;
+      measurement.value = vec3(entry.values[0], entry.values[1], entry.values[2]);
+      statistics.measurements.push_back(measurement);
+    }
+  }
+
+  std::stable_sort(statistics.records.begin(), statistics.records.end(),
+    [](const statistics_t::record_t& a, const statistics_t::record_t& b) {
+      return a.sample_index < b.sample_index; });
+  std::stable_sort(statistics.measurements.begin(), statistics.measurements.end(),
+    [](const statistics_t::measurement_t& a, const statistics_t::measurement_t& b) {
+      return a.sample_index < b.sample_index; });
+}
+
+statistics_t load_statistics(const string& image_path, const map<string, string>& metadata) {
+  statistics_t statistics(metadata);
+
+  auto itr = metadata.find("statistics.sidecar");
+
+  if (itr != metadata.end()) {
+    size_t slash = image_path.find_last_of("/\\");
+    string directory = slash == string::npos ? "" : image_path.substr(0, slash + 1);
+    string path = directory + itr->second;
+
+    // Images copied without their sidecar keep the totals of the header.
+    if (isfile(path)) {
+      load_statistics_sidecar(path, statistics);
+    }
+    else {
+      std::cerr << "Warning: `" << path << "` is missing, the per-frame statistics of `"
+                << image_path << "` are not available." << std::endl;
+    }
+  }
+
+  return statistics;
+}
+
+statistics_t load_statistics(const string& image_path) {
+  return load_statistics(image_path, load_metadata(image_path));
+}
+
+void statistics_sidecar_t::append(const string& path, const statistics_t& statistics) {
+  std::unique_lock<std::mutex> lock(sidecar_mutex);
+  FILE* file = nullptr;
+
+  if (_valid &&
+      statistics.records.size() >= _num_records &&
+      statistics.measurements.size() >= _num_measurements) {
+    file = fopen(path.c_str(), "ab");
+  }
+
+  // The file may have been replaced in the meantime (e.g. by a snapshot),
+  // append only if it still ends where the last append left it.
+  size_t expected_size =
+    sizeof(sidecar_header_t) +
+    (_num_records + _num_measurements) * sizeof(sidecar_entry_t);
+
+  if (file != nullptr &&
+      (fseek(file, 0, SEEK_END) != 0 || size_t(ftell(file)) != expected_size)) {
+    fclose(file);
+    file = nullptr;
+  }
+
+  if (file == nullptr) {
+    save_statistics_sidecar_locked(path, statistics);
+  }
+  else {
+    try {
+      write_entries(file, statistics, _num_records, _num_measurements);
+    }
+    catch (...) {
+      fclose(file);
+      throw;
+    }
+
+    fclose(file);
+  }
+
+  _valid = true;
+  _num_records = statistics.records.size();
+  _num_measurements = statistics.measurements.size();
+}
+
+unittest() {
+  statistics_t statistics;
+  statistics.records.resize(2);
+  statistics.records[1].sample_index = 1;
+  statistics.records[1].rms_error = 0.5f;
+  statistics.records[1].frame_duration = 0.25f;
+  statistics.records[1].num_photons = 4096;
+  statistics.measurements.resize(1);
+  statistics.measurements[0].pixel_x = 3;
+  statistics.measurements[0].value = vec3(1.0f, 2.0f, 3.0f);
+
+  string path = temppath(".stats");
+  statistics_sidecar_t sidecar;
+  sidecar.append(path, statistics);
+
+  statistics.records.resize(3);
+  statistics.records[2].sample_index = 2;
+  sidecar.append(path, statistics);
+
+  statistics_t loaded;
+  load_statistics_sidecar(path, loaded);
+  std::remove(path.c_str());
+
+  assert_true(loaded.records.size() == 3);
+  assert_true(loaded.records[2].sample_index == 2);
+  assert_almost_eq(loaded.records[1].rms_error, 0.5f);
+  assert_almost_eq(loaded.records[1].frame_duration, 0.25f);
+  assert_true(loaded.records[1].num_photons == 4096);
+  assert_true(loaded.measurements.size() == 1);
+  assert_true(loaded.measurements[0].pixel_x == 3);
+  assert_almost_eq(loaded.measurements[0].value, vec3(1.0f, 2.0f, 3.0f));
+}
+
 std::ostream& operator<<(std::ostream& stream, const statistics_t& meta) {
   double connection_time =
       meta.trace_eye_time - meta.trace_light_time - meta.gather_time;
@@ -189,7 +524,12 @@ std::ostream& operator<<(std::ostream& stream, const statistics_t& meta) {
          << (meta.num_scattered / meta.num_samples + meta.num_photons - 1) /
                 std::max(size_t(1), meta.num_photons)
          << "x)\n"
+         << "merges per query: "
+         << double(meta.num_merges) / double(std::max(size_t(1), meta.num_queries))
+         << "\n"
+         << "radius: " << meta.radius << "\n"
          << "total time: " << meta.total_time << "s\n"
+         << "accel build time: " << meta.accel_build_time << "s\n"
          << "time per sample:        " << meta.total_time / meta.num_samples
          << "s\n"
          << "    trace eye time:       "
@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <glm>
+#include <memory.hpp>
 
 namespace haste {
 
@@ -19,6 +20,9 @@ struct statistics_t {
   size_t num_tentative_rays = 0;
   size_t num_photons = 0;
   size_t num_scattered = 0;
+  size_t num_queries = 0;
+  size_t num_merges = 0;
+  double radius = 0.0;
   double total_time = 0.0;
   double scatter_time = 0.0;
   double build_time = 0.0;
@@ -28,6 +32,7 @@ struct statistics_t {
   double intersect_time = 0.0;
   double trace_eye_time = 0.0;
   double trace_light_time = 0.0;
+  double accel_build_time = 0.0;
 
   struct record_t {
 	  size_t sample_index = 0;
@@ -36,6 +41,9 @@ struct statistics_t {
     float clock_time;
     float frame_duration;
     size_t numeric_errors;
+    // The photon count and radius of the frame's last pass (VCM/UPG).
+    size_t num_photons = 0;
+    float radius = 0.0f;
   };
 
   struct measurement_t {
@@ -47,13 +55,34 @@ struct statistics_t {
     vec3 value;
   };
 
-  vector<record_t> records;
-  vector<measurement_t> measurements;
+  tracked_vector<record_t, memory_tag_t::statistics> records;
+  tracked_vector<measurement_t, memory_tag_t::statistics> measurements;
 
   statistics_t() = default;
   statistics_t(const map<string, string>& dict);
 
-  map<string, string> to_dict() const;
+  map<string, string> to_dict(bool with_series = true) const;
+};
+
+// Records and measurements can be stored in a binary sidecar next to the
+// image (<image>.stats) instead of the image header. The sidecar is a small
+// header followed by fixed size entries, so it can be appended to while
+// rendering and is read back with mmap.
+string statistics_path(const string& image_path);
+void save_statistics_sidecar(const string& path, const statistics_t& statistics);
+void load_statistics_sidecar(const string& path, statistics_t& statistics);
+
+statistics_t load_statistics(const string& image_path, const map<string, string>& metadata);
+statistics_t load_statistics(const string& image_path);
+
+class statistics_sidecar_t {
+public:
+  void append(const string& path, const statistics_t& statistics);
+
+private:
+  bool _valid = false;
+  size_t _num_records = 0;
+  size_t _num_measurements = 0;
 };
 
 std::ostream& operator<<(std::ostream& stream, const statistics_t& meta);
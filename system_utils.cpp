@@ -1,4 +1,5 @@
 #include <chrono>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <runtime_assert>
@@ -13,10 +14,20 @@
 #undef FLOAT
 #undef UINT
 #include <ShlObj.h>
+#include <process.h>
+#include <Psapi.h>
+#pragma comment(lib, "psapi.lib")
 #else
+#include <fcntl.h>
 #include <pwd.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
+
+extern char** environ;
 #endif
 
 namespace haste {
@@ -60,6 +71,12 @@ size_t getmtime(const string& path) {
 	return buf.st_mtime;
 }
 
+size_t getsize(const string& path) {
+	struct stat buf;
+	stat(path.c_str(), &buf);
+	return buf.st_size;
+}
+
 string fullpath(string relative_path) {
   #ifdef _MSC_VER
   auto buffer = _fullpath(nullptr, relative_path.c_str(), 0);
@@ -168,4 +185,174 @@ void move_file(string old_path, string new_path) {
   #endif
 }
 
+mapped_file_t::mapped_file_t(const string& path) {
+  #if defined _MSC_VER
+  FILE* file = fopen(path.c_str(), "rb");
+
+  if (file == nullptr) {
+    throw std::runtime_error("failed to open file");
+  }
+
+  fseek(file, 0, SEEK_END);
+  _buffer.resize(size_t(ftell(file)));
+  fseek(file, 0, SEEK_SET);
+  size_t read = fread(_buffer.data(), 1, _buffer.size(), file);
+  fclose(file);
+
+  if (read != _buffer.size()) {
+    throw std::runtime_error("failed to read file");
+  }
+
+  _data = _buffer.data();
+  _size = _buffer.size();
+  #else
+  int fd = open(path.c_str(), O_RDONLY);
+
+  if (fd == -1) {
+    throw std::runtime_error("failed to open file");
+  }
+
+  struct stat buf;
+
+  if (fstat(fd, &buf) != 0) {
+    close(fd);
+    throw std::runtime_error("failed to stat file");
+  }
+
+  _size = size_t(buf.st_size);
+
+  if (_size != 0) {
+    void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (data == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("failed to map file");
+    }
+
+    _data = (const char*)data;
+  }
+
+  close(fd);
+  #endif
+}
+
+mapped_file_t::~mapped_file_t() {
+  #if !defined _MSC_VER
+  if (_data != nullptr) {
+    munmap((void*)_data, _size);
+  }
+  #endif
+}
+
+intptr_t spawn_process(const vector<string>& args) {
+  vector<char*> argv;
+
+  for (auto&& arg : args) {
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+
+  argv.push_back(nullptr);
+
+  #if defined _MSC_VER
+  intptr_t process = _spawnvp(_P_NOWAIT, argv[0], argv.data());
+
+  if (process == -1) {
+    throw std::runtime_error("failed to spawn process");
+  }
+
+  return process;
+  #else
+  pid_t pid = 0;
+
+  if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) != 0) {
+    throw std::runtime_error("failed to spawn process");
+  }
+
+  return intptr_t(pid);
+  #endif
+}
+
+bool poll_process(intptr_t process, int& exit_code) {
+  #if defined _MSC_VER
+  if (WaitForSingleObject(HANDLE(process), 0) != WAIT_OBJECT_0) {
+    return false;
+  }
+
+  DWORD code = 0;
+  GetExitCodeProcess(HANDLE(process), &code);
+  CloseHandle(HANDLE(process));
+  exit_code = int(code);
+  return true;
+  #else
+  int status = 0;
+  pid_t result = waitpid(pid_t(process), &status, WNOHANG);
+
+  if (result == 0) {
+    return false;
+  }
+  else if (result == -1) {
+    throw std::runtime_error("failed to wait for process");
+  }
+
+  exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  return true;
+  #endif
+}
+
+size_t peak_rss() {
+  #if defined _MSC_VER
+  PROCESS_MEMORY_COUNTERS counters;
+
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return 0;
+  }
+
+  return counters.PeakWorkingSetSize;
+  #else
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+
+  #if defined __APPLE__
+  return size_t(usage.ru_maxrss);
+  #else
+  return size_t(usage.ru_maxrss) * 1024;
+  #endif
+  #endif
+}
+
+void binary_writer_t::write(const void* data, size_t size) {
+  if (size != 0 && fwrite(data, size, 1, file) != 1) {
+    throw std::runtime_error("failed to write file");
+  }
+}
+
+void binary_writer_t::write(const string& value) {
+  write(uint64_t(value.size()));
+  write(value.data(), value.size());
+}
+
+void binary_reader_t::read(void* data, size_t size) {
+  if (size_t(end - itr) < size) {
+    throw std::runtime_error("unexpected end of file");
+  }
+
+  if (size != 0) {
+    std::memcpy(data, itr, size);
+    itr += size;
+  }
+}
+
+string binary_reader_t::read_string() {
+  string result(size_t(read_u64()), '\0');
+
+  if (!result.empty()) {
+    read(&result[0], result.size());
+  }
+
+  return result;
+}
+
 }
@@ -1,4 +1,6 @@
 #pragma once
+#include <cstdint>
+#include <cstdio>
 #include <string>
 #include <vector>
 
@@ -11,6 +13,7 @@ using std::pair;
 string homePath();
 string baseName(string path);
 size_t getmtime(const string& path);
+size_t getsize(const string& path);
 
 string fullpath(string relative_path);
 string temppath(string extension = "");
@@ -19,4 +22,61 @@ bool isfile(string path);
 
 void move_file(string old_path, string new_path);
 
+// Helpers for the binary formats (checkpoints, caches). The writer throws
+// on failure, the reader throws when the input is truncated.
+struct binary_writer_t {
+  FILE* file;
+
+  void write(const void* data, size_t size);
+  void write(uint64_t value) { write(&value, sizeof(value)); }
+  void write(double value) { write(&value, sizeof(value)); }
+  void write(const string& value);
+
+  template <class T> void write_vector(const vector<T>& values) {
+    write(uint64_t(values.size()));
+    write(values.data(), values.size() * sizeof(T));
+  }
+};
+
+struct binary_reader_t {
+  const char* itr;
+  const char* end;
+
+  void read(void* data, size_t size);
+  uint64_t read_u64() { uint64_t value; read(&value, sizeof(value)); return value; }
+  double read_f64() { double value; read(&value, sizeof(value)); return value; }
+  string read_string();
+
+  template <class T> void read_vector(vector<T>& values) {
+    values.resize(size_t(read_u64()));
+    read(values.data(), values.size() * sizeof(T));
+  }
+};
+
+// Child processes. spawn_process returns a handle for poll_process, which
+// returns true once the process has exited and sets its exit code.
+intptr_t spawn_process(const vector<string>& args);
+bool poll_process(intptr_t process, int& exit_code);
+
+// Peak resident set size of the process in bytes, 0 if unavailable.
+size_t peak_rss();
+
+// Read-only view of a whole file, memory mapped where the platform allows.
+class mapped_file_t {
+public:
+  mapped_file_t(const string& path);
+  ~mapped_file_t();
+
+  const char* data() const { return _data; }
+  size_t size() const { return _size; }
+
+private:
+  mapped_file_t(const mapped_file_t&) = delete;
+  mapped_file_t& operator=(const mapped_file_t&) = delete;
+
+  const char* _data = nullptr;
+  size_t _size = 0;
+  vector<char> _buffer;
+};
+
 }
@@ -0,0 +1,54 @@
+#include <xmmintrin.h>
+#include <pmmintrin.h>
+
+#include <cmath>
+#include <unittest>
+#include <glm>
+
+// Entry point of the test build (make tests). The unittest() registry is
+// compiled in only with UNITTEST defined, master.bin doesn't carry it.
+
+using namespace std;
+using namespace glm;
+using namespace haste;
+
+unittest() {
+  #if defined _MSC_VER
+	#pragma warning( disable : 4723)
+  #endif
+
+    // check if everything is configured well
+    assert_almost_eq(sin(half_pi<float>()), 1.0f);
+    assert_almost_eq(asin(1.0f), half_pi<float>());
+
+    #if !defined _MSC_VER
+    assert_true(std::isinf(1.0f / 0.0f));
+    assert_false(std::isnan(1.0f / 1.0f));
+    assert_true(std::isnan(0.0f / 0.0f));
+    assert_true(std::isnan(-0.0f / 0.0f));
+    #endif
+}
+
+unittest() {
+    // default constructed matrix is identity matrix
+    assert_almost_eq(mat4() * vec4(1.0f, 2.0f, 3.0f, 4.0f), vec4(1.0f, 2.0f, 3.0f, 4.0f));
+
+    // matrix indexing is column major
+    mat4 m;
+    m[0] = vec4(1.0f, 1.0f, 0.0f, 0.0f);
+
+    // 1 0 0 0
+    // 1 1 0 0
+    // 0 0 1 0
+    // 0 0 0 1
+    // ^
+
+    assert_almost_eq(m * vec4(1.0f), vec4(1.0f, 2.0f, 1.0f, 1.0f));
+}
+
+int main(int argc, char **argv) {
+    _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+    _MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
+
+    return run_all_tests() ? 0 : 1;
+}
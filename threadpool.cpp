@@ -2,10 +2,107 @@
 #include <mutex>
 #include <stdexcept>
 #include <algorithm>
+#include <unittest>
 #include <threadpool.hpp>
 
 namespace haste {
 
+static size_t morton_compact(size_t x) {
+  x &= 0x5555555555555555ull;
+  x = (x | (x >> 1)) & 0x3333333333333333ull;
+  x = (x | (x >> 2)) & 0x0f0f0f0f0f0f0f0full;
+  x = (x | (x >> 4)) & 0x00ff00ff00ff00ffull;
+  x = (x | (x >> 8)) & 0x0000ffff0000ffffull;
+  x = (x | (x >> 16)) & 0x00000000ffffffffull;
+  return x;
+}
+
+void morton_decode(size_t d, size_t& x, size_t& y) {
+  x = morton_compact(d);
+  y = morton_compact(d >> 1);
+}
+
+void hilbert_decode(size_t side, size_t d, size_t& x, size_t& y) {
+  x = 0;
+  y = 0;
+
+  for (size_t s = 1; s < side; s *= 2) {
+    size_t rx = 1 & (d / 2);
+    size_t ry = 1 & (d ^ rx);
+
+    if (ry == 0) {
+      if (rx == 1) {
+        x = s - 1 - x;
+        y = s - 1 - y;
+      }
+
+      std::swap(x, y);
+    }
+
+    x += s * rx;
+    y += s * ry;
+    d /= 4;
+  }
+}
+
+void traversal_decode(traversal_order_t order, size_t side, size_t d,
+                      size_t& x, size_t& y) {
+  switch (order) {
+    case traversal_order_t::morton:
+      morton_decode(d, x, y);
+      break;
+    case traversal_order_t::hilbert:
+      hilbert_decode(side, d, x, y);
+      break;
+    default:
+      x = d / side;
+      y = d % side;
+      break;
+  }
+}
+
+size_t traversal_side(size_t width, size_t height) {
+  size_t side = 1;
+
+  while (side < width || side < height) {
+    side *= 2;
+  }
+
+  return side;
+}
+
+unittest() {
+  const size_t side = 8;
+  bool visited[side * side] = { false };
+  size_t px = 0, py = 0;
+
+  for (size_t d = 0; d < side * side; ++d) {
+    size_t x = 0, y = 0;
+    hilbert_decode(side, d, x, y);
+
+    assert_true(x < side && y < side);
+    assert_false(visited[y * side + x]);
+    visited[y * side + x] = true;
+
+    if (d != 0) {
+      size_t dx = x < px ? px - x : x - px;
+      size_t dy = y < py ? py - y : y - py;
+      assert_true(dx + dy == 1);
+    }
+
+    px = x;
+    py = y;
+  }
+}
+
+unittest() {
+  size_t x = 0, y = 0;
+  morton_decode(0b110110, x, y);
+  assert_true(x == 0b010);
+  assert_true(y == 0b111);
+  assert_true(traversal_side(33, 5) == 64);
+}
+
 struct data_queue_thunk_t {
   std::size_t size;
   char data[sizeof(data_queue_thunk_t::size)];
@@ -188,43 +285,67 @@ size_t threadpool_t::num_threads() { return _threads.size(); }
 namespace detail {
 
 void exec2d(threadpool_t& pool, size_t width, size_t height, size_t batch,
-            void* closure,
+            traversal_order_t order, void* closure,
             void (*callback)(void*, size_t, size_t, size_t, size_t)) {
   size_t num_cols = (width + batch - 1) / batch;
   size_t num_rows = (height + batch - 1) / batch;
   size_t num_cells = num_cols * num_rows;
 
-  if (pool.num_threads() == 1) {
+  // Tiles are dispatched in curve order, the queue is FIFO, so consecutive
+  // tiles picked up by the workers stay close in screen space.
+  std::vector<std::pair<size_t, size_t>> cells;
+  cells.reserve(num_cells);
+
+  if (order == traversal_order_t::linear) {
     for (size_t col = 0; col < num_cols; ++col) {
       for (size_t row = 0; row < num_rows; ++row) {
-        size_t x0 = col * batch;
-        size_t x1 = std::min(width, x0 + batch);
-        size_t y0 = row * batch;
-        size_t y1 = std::min(height, y0 + batch);
-        callback(closure, x0, x1, y0, y1);
+        cells.emplace_back(col, row);
       }
     }
   }
+  else {
+    size_t side = traversal_side(num_cols, num_rows);
+
+    for (size_t d = 0; d < side * side; ++d) {
+      size_t col = 0, row = 0;
+      traversal_decode(order, side, d, col, row);
+
+      if (col < num_cols && row < num_rows) {
+        cells.emplace_back(col, row);
+      }
+    }
+  }
+
+  if (pool.num_threads() == 1) {
+    for (auto&& cell : cells) {
+      size_t x0 = cell.first * batch;
+      size_t x1 = std::min(width, x0 + batch);
+      size_t y0 = cell.second * batch;
+      size_t y1 = std::min(height, y0 + batch);
+      callback(closure, x0, x1, y0, y1);
+    }
+  }
   else {
     std::mutex mutex;
     std::condition_variable condition;
     std::atomic<size_t> counter(0);
 
-    for (size_t col = 0; col < num_cols; ++col) {
-      for (size_t row = 0; row < num_rows; ++row) {
-        pool.exec([=, &mutex, &counter, &condition] {
-          size_t x0 = col * batch;
-          size_t x1 = std::min(width, x0 + batch);
-          size_t y0 = row * batch;
-          size_t y1 = std::min(height, y0 + batch);
-          callback(closure, x0, x1, y0, y1);
-
-          if (counter.fetch_add(1) == num_cells - 1) {
-            std::unique_lock<std::mutex> lock(mutex);
-            condition.notify_one();
-          }
-        });
-      }
+    for (auto&& cell : cells) {
+      size_t col = cell.first;
+      size_t row = cell.second;
+
+      pool.exec([=, &mutex, &counter, &condition] {
+        size_t x0 = col * batch;
+        size_t x1 = std::min(width, x0 + batch);
+        size_t y0 = row * batch;
+        size_t y1 = std::min(height, y0 + batch);
+        callback(closure, x0, x1, y0, y1);
+
+        if (counter.fetch_add(1) == num_cells - 1) {
+          std::unique_lock<std::mutex> lock(mutex);
+          condition.notify_one();
+        }
+      });
     }
 
     std::unique_lock<std::mutex> lock(mutex);
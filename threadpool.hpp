@@ -3,12 +3,21 @@
 #include <cstddef>
 #include <cstdlib>
 #include <thread>
+#include <utility>
 #include <vector>
 
 namespace haste {
 
 using std::size_t;
 
+enum class traversal_order_t { linear, morton, hilbert };
+
+void morton_decode(size_t d, size_t& x, size_t& y);
+void hilbert_decode(size_t side, size_t d, size_t& x, size_t& y);
+void traversal_decode(traversal_order_t order, size_t side, size_t d,
+                      size_t& x, size_t& y);
+size_t traversal_side(size_t width, size_t height);
+
 class data_queue_t {
  public:
   data_queue_t(size_t capacity = 1024);
@@ -82,6 +91,9 @@ class task_queue_t {
   };
 };
 
+// Number of hardware threads, threadpool_t(0) starts as many.
+size_t default_num_cores();
+
 class threadpool_t {
  public:
   threadpool_t(size_t num_threads = 0);
@@ -105,7 +117,7 @@ class threadpool_t {
 
 namespace detail {
 
-void exec2d(threadpool_t&, size_t, size_t, size_t, void*,
+void exec2d(threadpool_t&, size_t, size_t, size_t, traversal_order_t, void*,
             void (*)(void*, size_t, size_t, size_t, size_t));
 
 void exec_in_bands(threadpool_t&, size_t, size_t, size_t, void*,
@@ -116,14 +128,21 @@ void generate(threadpool_t&, void**, size_t, void*, void (*)(void*, void*, size_
 
 template <class F>
 void exec2d(threadpool_t& pool, size_t width, size_t height, size_t batch,
-            F&& task) {
-  detail::exec2d(pool, width, height, batch, &task,
+            traversal_order_t order, F&& task) {
+  detail::exec2d(pool, width, height, batch, order, &task,
                  [](void* closure, size_t x0, size_t x1, size_t y0, size_t y1) {
                    using Closure = typename std::decay<F>::type;
                    (*reinterpret_cast<Closure*>(closure))(x0, x1, y0, y1);
                  });
 }
 
+template <class F>
+void exec2d(threadpool_t& pool, size_t width, size_t height, size_t batch,
+            F&& task) {
+  exec2d(pool, width, height, batch, traversal_order_t::linear,
+         std::forward<F>(task));
+}
+
 template <class F>
 void exec_in_bands(threadpool_t& pool, size_t width, size_t height,
                    size_t batch, F&& task) {
@@ -135,6 +154,15 @@ void exec_in_bands(threadpool_t& pool, size_t width, size_t height,
       });
 }
 
+// Runs task(begin, end) over [0, size) in batches of the given size.
+template <class F>
+void exec1d(threadpool_t& pool, size_t size, size_t batch, F&& task) {
+  exec_in_bands(pool, 1, size, batch,
+                [&](size_t, size_t, size_t begin, size_t end) {
+                  task(begin, end);
+                });
+}
+
 template <class T, class F>
 std::vector<T> generate(threadpool_t& pool, std::size_t number, F&& task) {
   std::vector<std::vector<T>> results(pool.num_threads());
@@ -0,0 +1,69 @@
+#include <gtest>
+#include <HashGrid3D.hpp>
+#include <random>
+
+using namespace glm;
+using namespace haste;
+
+struct HashGrid3DPoint {
+    vec3 _position;
+    const vec3& position() const { return _position; }
+    bool is_light() const { return false; }
+};
+
+TEST(HashGrid3D, batched_query_matches_single_queries) {
+    std::mt19937 engine(0);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    vector<HashGrid3DPoint> points(1000);
+    vector<vec3> queries(37);
+
+    for (auto& point : points) {
+        point._position = vec3(uniform(engine), uniform(engine), uniform(engine));
+    }
+
+    for (auto& query : queries) {
+        query = vec3(uniform(engine), uniform(engine), uniform(engine));
+    }
+
+    v3::HashGrid3D<HashGrid3DPoint> grid(&points, 0.1f);
+    vector<vector<uint32_t>> expected(queries.size());
+    vector<vector<uint32_t>> actual(queries.size());
+
+    for (size_t i = 0; i < queries.size(); ++i) {
+        grid.rQuery([&](uint32_t index) { expected[i].push_back(index); }, queries[i], 0.1f);
+    }
+
+    grid.rQueryBatch<8>(
+        [&](size_t query, uint32_t index) { actual[query].push_back(index); },
+        queries.data(),
+        queries.size(),
+        0.1f);
+
+    // the batched queries report the same points in the same order
+    for (size_t i = 0; i < queries.size(); ++i) {
+        EXPECT_EQ(expected[i], actual[i]);
+    }
+}
+
+TEST(HashGrid3D, batched_query_handles_partial_group) {
+    vector<HashGrid3DPoint> points(3);
+    points[0]._position = vec3(0.0f);
+    points[1]._position = vec3(0.05f, 0.0f, 0.0f);
+    points[2]._position = vec3(1.0f);
+
+    vector<vec3> queries = { vec3(0.0f), vec3(1.0f), vec3(0.5f) };
+
+    v3::HashGrid3D<HashGrid3DPoint> grid(&points, 0.1f);
+    vector<vector<uint32_t>> actual(queries.size());
+
+    grid.rQueryBatch<8>(
+        [&](size_t query, uint32_t index) { actual[query].push_back(index); },
+        queries.data(),
+        queries.size(),
+        0.1f);
+
+    EXPECT_EQ(2u, actual[0].size());
+    EXPECT_EQ(vector<uint32_t>({ 2u }), actual[1]);
+    EXPECT_TRUE(actual[2].empty());
+}
@@ -167,4 +167,76 @@ double high_resolution_time() {
   return std::chrono::duration_cast<std::chrono::duration<double>>(duration)
       .count();
 }
+static const double process_start_time = high_resolution_time();
+
+void startup_report_t::mark(const string& name) {
+  double now = high_resolution_time();
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  if (!_finished) {
+    double last = _phases.empty() ? process_start_time : _last;
+    _phases.push_back({name, now - last, peak_rss()});
+    _last = now;
+  }
+}
+
+void startup_report_t::finish() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _finished = true;
+}
+
+bool startup_report_t::finished() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _finished;
+}
+
+vector<startup_phase_t> startup_report_t::phases() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _phases;
+}
+
+map<string, string> startup_report_t::to_dict() const {
+  map<string, string> result;
+  double total = 0.0;
+
+  for (auto&& phase : phases()) {
+    total += phase.time;
+    result["startup." + phase.name + ".time"] = std::to_string(phase.time);
+    result["startup." + phase.name + ".peak_rss"] =
+        std::to_string(phase.peak_rss);
+  }
+
+  result["startup.total_time"] = std::to_string(total);
+  return result;
+}
+
+startup_report_t& process_startup_report() {
+  static startup_report_t report;
+  return report;
+}
+
+std::ostream& operator<<(std::ostream& stream, const startup_report_t& report) {
+  auto phases = report.phases();
+  auto flags = stream.flags();
+  auto precision = stream.precision();
+  double total = 0.0;
+
+  stream << "Startup report:\n";
+
+  for (auto&& phase : phases) {
+    total += phase.time;
+    stream << "  " << std::left << std::setw(16) << phase.name << std::right
+           << std::fixed << std::setprecision(4) << std::setw(10)
+           << phase.time << "s" << std::setw(10) << std::setprecision(1)
+           << double(phase.peak_rss) / (1024.0 * 1024.0) << " MiB\n";
+  }
+
+  stream << "  " << std::left << std::setw(16) << "total" << std::right
+         << std::setw(10) << std::setprecision(4) << total << "s\n";
+  stream.flags(flags);
+  stream.precision(precision);
+
+  return stream;
+}
+
 }
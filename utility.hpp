@@ -6,6 +6,7 @@
 #include <string>
 #include <vector>
 #include <iosfwd>
+#include <mutex>
 
 namespace haste {
 
@@ -49,4 +50,33 @@ struct time_scope_t {
   double& _timer;
   double _start;
 };
+
+// Startup phases, from the process start to the first sample. A phase lasts
+// from the previous mark to its own, marks after finish() (scene reloads)
+// are ignored.
+struct startup_phase_t {
+  string name;
+  double time;
+  size_t peak_rss;
+};
+
+class startup_report_t {
+ public:
+  void mark(const string& name);
+  void finish();
+  bool finished() const;
+
+  vector<startup_phase_t> phases() const;
+  map<string, string> to_dict() const;
+
+ private:
+  mutable std::mutex _mutex;
+  vector<startup_phase_t> _phases;
+  double _last = 0.0;
+  bool _finished = false;
+};
+
+startup_report_t& process_startup_report();
+
+std::ostream& operator<<(std::ostream& stream, const startup_report_t& report);
 }